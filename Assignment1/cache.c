@@ -0,0 +1,423 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <limits.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "cache.h"
+
+typedef struct {
+    unsigned long long hits;
+    unsigned long long misses;
+    unsigned long long bypasses; // Runs that could not be cached because a piped stdin could not be spooled
+} cache_stats;
+
+typedef struct {
+    char *data;
+    size_t used;
+    size_t capacity;
+} cache_key;
+
+typedef struct {
+    char name[NAME_MAX + 1];
+    off_t size;
+    struct timespec last_use;
+} cache_entry;
+
+char cache_dir[PATH_MAX];
+
+int is_cached_command(char **args) {
+    return args[0] != NULL && strcmp(args[0], "cached") == 0;
+}
+
+void key_append(cache_key *key, const char *data, size_t size) {
+    if (key->used + size > key->capacity) {
+        key->capacity = (key->used + size) * 2;
+        key->data = (char *)realloc(key->data, key->capacity);
+    }
+    memcpy(key->data + key->used, data, size);
+    key->used += size;
+}
+
+void key_append_file(cache_key *key, const char *tag, const char *path, struct stat *st) {
+    char identity[128];
+    key_append(key, tag, strlen(tag) + 1);
+    key_append(key, path, strlen(path) + 1);
+    int length = snprintf(identity, sizeof(identity), "%llu %llu %lld %lld.%09ld",
+                          (unsigned long long)st->st_dev, (unsigned long long)st->st_ino,
+                          (long long)st->st_size, (long long)st->st_mtim.tv_sec, st->st_mtim.tv_nsec);
+    key_append(key, identity, length + 1);
+}
+
+unsigned long long fnv1a(unsigned long long hash, const char *data, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        hash ^= (unsigned char)data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+int resolve_binary(const char *name, char *path) {
+    if (strchr(name, '/')) {
+        snprintf(path, PATH_MAX, "%s", name);
+        return access(path, X_OK) == 0;
+    }
+    const char *dirs = getenv("PATH");
+    if (dirs == NULL) dirs = "/bin:/usr/bin";
+    while (*dirs) {
+        size_t length = strcspn(dirs, ":");
+        snprintf(path, PATH_MAX, "%.*s/%s", (int)length, length ? dirs : ".", name);
+        if (access(path, X_OK) == 0) return 1;
+        dirs += length + (dirs[length] == ':');
+    }
+    return 0;
+}
+
+int open_cache_dir() {
+    const char *dir = getenv("ESHELL_CACHE_DIR");
+    if (dir != NULL) {
+        snprintf(cache_dir, sizeof(cache_dir), "%s", dir);
+    } else {
+        const char *home = getenv("HOME");
+        snprintf(cache_dir, sizeof(cache_dir), "%s/.cache", home ? home : "/tmp");
+        mkdir(cache_dir, 0755);
+        strncat(cache_dir, "/eshell", sizeof(cache_dir) - strlen(cache_dir) - 1);
+    }
+    if (mkdir(cache_dir, 0755) == -1 && errno != EEXIST) {
+        perror(cache_dir);
+        return 0;
+    }
+    return 1;
+}
+
+/***
+ * Adds the given counts to the shared statistics file and returns the totals.
+ * @param hits
+ * @param misses
+ * @param bypasses
+ * @return
+ */
+cache_stats update_stats(int hits, int misses, int bypasses) {
+    char path[PATH_MAX];
+    cache_stats stats;
+    memset(&stats, 0, sizeof(stats));
+    if (snprintf(path, sizeof(path), "%s/stats", cache_dir) >= (int)sizeof(path)) return stats;
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd == -1) return stats;
+
+    flock(fd, LOCK_EX);
+    pread(fd, &stats, sizeof(stats), 0);
+    stats.hits += hits;
+    stats.misses += misses;
+    stats.bypasses += bypasses;
+    if (hits || misses || bypasses) pwrite(fd, &stats, sizeof(stats), 0);
+    flock(fd, LOCK_UN);
+    close(fd);
+    return stats;
+}
+
+int copy_fd(int from, int to, int also_to) {
+    char buffer[CACHE_COPY_BUFFER_SIZE];
+    ssize_t nbytes;
+    int ok = 1;
+    while ((nbytes = read(from, buffer, sizeof(buffer))) > 0) {
+        if (to != -1 && write(to, buffer, nbytes) != nbytes) to = -1; // keep storing if the reader left
+        if (also_to != -1 && write(also_to, buffer, nbytes) != nbytes) ok = 0;
+    }
+    return ok && nbytes == 0;
+}
+
+int compare_entries(const void *a, const void *b) {
+    const cache_entry *x = (const cache_entry *)a;
+    const cache_entry *y = (const cache_entry *)b;
+    if (x->last_use.tv_sec != y->last_use.tv_sec) return x->last_use.tv_sec < y->last_use.tv_sec ? -1 : 1;
+    if (x->last_use.tv_nsec != y->last_use.tv_nsec) return x->last_use.tv_nsec < y->last_use.tv_nsec ? -1 : 1;
+    return 0;
+}
+
+/***
+ * Lists the stored outputs and their total size. The caller frees the list.
+ * @param entries
+ * @param total
+ * @return
+ */
+size_t list_entries(cache_entry **entries, unsigned long long *total) {
+    size_t count = 0, capacity = 0;
+    *entries = NULL;
+    *total = 0;
+    DIR *dir = opendir(cache_dir);
+    if (dir == NULL) return 0;
+
+    struct dirent *dirent;
+    struct stat st;
+    while ((dirent = readdir(dir)) != NULL) {
+        size_t length = strlen(dirent->d_name);
+        if (length < 4 || strcmp(dirent->d_name + length - 4, ".out") != 0) continue;
+        if (fstatat(dirfd(dir), dirent->d_name, &st, 0) == -1) continue;
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            *entries = (cache_entry *)realloc(*entries, capacity * sizeof(cache_entry));
+        }
+        snprintf((*entries)[count].name, sizeof((*entries)[count].name), "%.*s", (int)(length - 4), dirent->d_name);
+        (*entries)[count].size = st.st_size;
+        (*entries)[count].last_use = st.st_mtim;
+        *total += st.st_size;
+        count++;
+    }
+    closedir(dir);
+    return count;
+}
+
+// Removes the least recently used entries until the cache fits into its size limit.
+void evict_entries() {
+    const char *limit_env = getenv("ESHELL_CACHE_SIZE");
+    unsigned long long limit = limit_env ? strtoull(limit_env, NULL, 10) : CACHE_DEFAULT_SIZE;
+    unsigned long long total;
+    cache_entry *entries;
+    size_t count = list_entries(&entries, &total);
+
+    if (total > limit) {
+        char path[PATH_MAX];
+        qsort(entries, count, sizeof(cache_entry), compare_entries);
+        for (size_t i = 0; i < count && total > limit; i++) {
+            if (snprintf(path, sizeof(path), "%s/%s.meta", cache_dir, entries[i].name) < (int)sizeof(path)) {
+                unlink(path);
+            }
+            if (snprintf(path, sizeof(path), "%s/%s.out", cache_dir, entries[i].name) < (int)sizeof(path)) {
+                unlink(path);
+            }
+            total -= entries[i].size;
+        }
+    }
+    free(entries);
+}
+
+/***
+ * Replays the entry if its metadata holds the same key. Returns 1 on a hit.
+ * @param base
+ * @param key
+ * @param status
+ * @return
+ */
+int replay_entry(const char *base, cache_key *key, int *status) {
+    char path[PATH_MAX];
+    if (snprintf(path, sizeof(path), "%s.meta", base) >= (int)sizeof(path)) return 0;
+    int meta = open(path, O_RDONLY);
+    if (meta == -1) return 0;
+
+    size_t key_size = 0;
+    int hit = read(meta, status, sizeof(int)) == sizeof(int) &&
+              read(meta, &key_size, sizeof(size_t)) == sizeof(size_t) && key_size == key->used;
+    if (hit) {
+        char *stored = (char *)malloc(key_size);
+        hit = read(meta, stored, key_size) == (ssize_t)key_size && memcmp(stored, key->data, key_size) == 0;
+        free(stored);
+    }
+    close(meta);
+    if (!hit) return 0;
+
+    if (snprintf(path, sizeof(path), "%s.out", base) >= (int)sizeof(path)) return 0;
+    int out = open(path, O_RDONLY);
+    if (out == -1) return 0;
+    copy_fd(out, -1, STDOUT_FILENO);
+    close(out);
+    utimensat(AT_FDCWD, path, NULL, 0); // mark as recently used
+    return 1;
+}
+
+/***
+ * Runs the command with its stdout copied into the entry and stores the exit code.
+ * Files are written under temporary names and renamed so readers never see half an entry.
+ * @param base
+ * @param key
+ * @param args
+ * @return
+ */
+int store_entry(const char *base, cache_key *key, char **args) {
+    char out_path[PATH_MAX], meta_path[PATH_MAX], tmp_out[PATH_MAX], tmp_meta[PATH_MAX];
+    // base is checked to leave room for the suffixes in run_cached
+    snprintf(out_path, sizeof(out_path), "%s.out", base);
+    snprintf(meta_path, sizeof(meta_path), "%s.meta", base);
+    snprintf(tmp_out, sizeof(tmp_out), "%s.out.%d", base, (int)getpid());
+    snprintf(tmp_meta, sizeof(tmp_meta), "%s.meta.%d", base, (int)getpid());
+
+    int fds[2];
+    int out = open(tmp_out, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out == -1 || pipe(fds) == -1) {
+        perror("cached");
+        return EXIT_FAILURE;
+    }
+
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("fork");
+        return EXIT_FAILURE;
+    } else if (pid == 0) { // Child process
+        close(out);
+        close(fds[0]);
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[1]);
+        signal(SIGPIPE, SIG_DFL);
+        execvp(args[0], args);
+        perror("execvp");
+        _exit(EXIT_FAILURE);
+    }
+
+    close(fds[1]);
+    int stored = copy_fd(fds[0], STDOUT_FILENO, out);
+    close(fds[0]);
+    close(out);
+
+    int status;
+    waitpid(pid, &status, 0);
+    if (!stored || !WIFEXITED(status)) {
+        unlink(tmp_out);
+        return WIFSIGNALED(status) ? 128 + WTERMSIG(status) : WEXITSTATUS(status);
+    }
+
+    int code = WEXITSTATUS(status);
+    int meta = open(tmp_meta, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (meta != -1 && write(meta, &code, sizeof(int)) == sizeof(int) &&
+        write(meta, &key->used, sizeof(size_t)) == sizeof(size_t) &&
+        write(meta, key->data, key->used) == (ssize_t)key->used) {
+        close(meta);
+        rename(tmp_out, out_path);
+        rename(tmp_meta, meta_path);
+        evict_entries();
+    } else {
+        if (meta != -1) close(meta);
+        unlink(tmp_out);
+        unlink(tmp_meta);
+    }
+    return code;
+}
+
+/***
+ * Copies a piped stdin into an unlinked file of the cache directory, hashes it into the key
+ * on the way and puts the file on stdin, so the command still reads the whole input.
+ * Returns 0 if there is no room for the file, stdin is untouched then, and -1 if stdin was
+ * consumed but could not be stored.
+ * @param key
+ * @return
+ */
+int spool_stdin(cache_key *key) {
+    char path[PATH_MAX];
+    if (snprintf(path, sizeof(path), "%s/stdin.%d", cache_dir, (int)getpid()) >= (int)sizeof(path)) return 0;
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd == -1) return 0;
+    unlink(path);
+
+    char buffer[CACHE_COPY_BUFFER_SIZE];
+    unsigned long long hash = FNV_OFFSET_BASIS, size = 0;
+    ssize_t nbytes;
+    while ((nbytes = read(STDIN_FILENO, buffer, sizeof(buffer))) > 0) {
+        if (write(fd, buffer, nbytes) != nbytes) break;
+        hash = fnv1a(hash, buffer, nbytes);
+        size += nbytes;
+    }
+    if (nbytes != 0 || lseek(fd, 0, SEEK_SET) == -1) {
+        close(fd);
+        return -1;
+    }
+    dup2(fd, STDIN_FILENO);
+    close(fd);
+
+    char digest[64];
+    int length = snprintf(digest, sizeof(digest), "%llu %016llx", size, hash);
+    key_append(key, "stdin", sizeof("stdin"));
+    key_append(key, digest, length + 1);
+    return 1;
+}
+
+int print_stats() {
+    cache_entry *entries;
+    unsigned long long total;
+    cache_stats stats = update_stats(0, 0, 0);
+    size_t count = list_entries(&entries, &total);
+    free(entries);
+    printf("hits: %llu, misses: %llu, uncached: %llu, entries: %zu, bytes: %llu\n",
+           stats.hits, stats.misses, stats.bypasses, count, total);
+    fflush(stdout);
+    return EXIT_SUCCESS;
+}
+
+int run_cached(char **args) {
+    int first = 1;
+    char path[PATH_MAX];
+    struct stat st;
+    cache_key key;
+    memset(&key, 0, sizeof(key));
+
+    if (!open_cache_dir()) return EXIT_FAILURE;
+    if (args[first] != NULL && strcmp(args[first], "--stats") == 0) return print_stats();
+
+    if (getcwd(path, sizeof(path)) != NULL) key_append(&key, path, strlen(path) + 1);
+    for (; args[first] != NULL && strcmp(args[first], "-i") == 0 && args[first + 1] != NULL; first += 2) {
+        if (stat(args[first + 1], &st) == 0) {
+            key_append_file(&key, "input", args[first + 1], &st);
+        } else {
+            key_append(&key, "missing", sizeof("missing"));
+            key_append(&key, args[first + 1], strlen(args[first + 1]) + 1);
+        }
+    }
+    char **cmd = args + first;
+    if (cmd[0] == NULL) {
+        fprintf(stderr, "Usage: cached [-i file]... command [args] | cached --stats\n");
+        return EXIT_FAILURE;
+    }
+
+    if (fstat(STDIN_FILENO, &st) == 0) {
+        if (S_ISREG(st.st_mode)) {
+            key_append_file(&key, "stdin", "", &st);
+        } else if (S_ISFIFO(st.st_mode) || S_ISSOCK(st.st_mode)) {
+            int spooled = spool_stdin(&key);
+            if (spooled == -1) {
+                perror("cached");
+                return EXIT_FAILURE;
+            } else if (spooled == 0) {
+                update_stats(0, 0, 1);
+                execvp(cmd[0], cmd);
+                perror("execvp");
+                return EXIT_FAILURE;
+            }
+        } else {
+            int null_fd = open("/dev/null", O_RDONLY);
+            dup2(null_fd, STDIN_FILENO);
+            close(null_fd);
+        }
+    }
+
+    if (!resolve_binary(cmd[0], path) || stat(path, &st) == -1) {
+        fprintf(stderr, "%s: command not found\n", cmd[0]);
+        return 127;
+    }
+    key_append_file(&key, "binary", path, &st);
+    signal(SIGPIPE, SIG_IGN); // outputs are still stored and counted if our reader exits early
+    for (int i = 0; cmd[i] != NULL; i++) {
+        key_append(&key, cmd[i], strlen(cmd[i]) + 1);
+        if (stat(cmd[i], &st) == 0 && S_ISREG(st.st_mode)) {
+            key_append_file(&key, "file", cmd[i], &st);
+        }
+    }
+
+    char base[PATH_MAX];
+    int status;
+    if (snprintf(base, sizeof(base) - CACHE_SUFFIX_ROOM, "%s/%016llx", cache_dir,
+                 fnv1a(FNV_OFFSET_BASIS, key.data, key.used)) >= (int)sizeof(base) - CACHE_SUFFIX_ROOM) {
+        fprintf(stderr, "cached: %s is too long\n", cache_dir);
+        free(key.data);
+        return EXIT_FAILURE;
+    }
+    if (replay_entry(base, &key, &status)) {
+        update_stats(1, 0, 0);
+    } else {
+        update_stats(0, 1, 0);
+        status = store_entry(base, &key, cmd);
+    }
+    free(key.data);
+    return status;
+}
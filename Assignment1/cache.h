@@ -0,0 +1,42 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "parser.h"
+
+#define CACHE_DEFAULT_SIZE (64ULL * 1024 * 1024) // Bytes of stored output kept before eviction
+#define CACHE_COPY_BUFFER_SIZE (64 * 1024)
+#define CACHE_SUFFIX_ROOM 32 // Bytes kept free after an entry's path for ".meta.<pid>"
+#define FNV_OFFSET_BASIS 14695981039346656037ULL
+
+/***
+ * Returns 1 if the command starts with the cached prefix.
+ * @param args
+ * @return
+ */
+int is_cached_command(char **args);
+
+/***
+ * Finds the binary execvp would run for name and writes it to path (PATH_MAX bytes).
+ * Returns 0 if there is none.
+ * @param name
+ * @param path
+ * @return
+ */
+int resolve_binary(const char *name, char *path);
+
+/***
+ * Runs "cached [-i file]... command args" and returns the exit code.
+ * The key is the working directory, the arguments, the resolved binary and the identity
+ * (path, size, mtime, inode) of every argument that is a regular file, every file declared
+ * with -i and stdin if it is a regular file. On a hit the stored stdout and exit code are replayed.
+ * A piped stdin is spooled to a file first and its size and hash go into the key, so commands
+ * inside pipelines are cached as well. If stdin is a terminal the command gets /dev/null.
+ * "cached --stats" prints the hit/miss counters and the cache size.
+ * The cache lives in $ESHELL_CACHE_DIR or ~/.cache/eshell and is bounded by $ESHELL_CACHE_SIZE
+ * bytes with least recently used entries evicted first.
+ * @param args
+ * @return
+ */
+int run_cached(char **args);
+
+#endif //CACHE_H
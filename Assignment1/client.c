@@ -0,0 +1,161 @@
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <time.h>
+#include "server.h"
+
+/***
+ * Sends one command line to the eshell server together with this process's
+ * stdin, stdout and stderr, then waits for the reply.
+ * Returns 1 if a reply is received and 0 otherwise.
+ * @param path
+ * @param line
+ * @param reply
+ * @return
+ */
+int send_request(const char *path, const char *line, server_reply *reply) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+    int conn = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (conn == -1) {
+        perror("socket");
+        return 0;
+    }
+    if (connect(conn, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        perror(path);
+        close(conn);
+        return 0;
+    }
+
+    int fds[SERVER_NUM_FDS] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+    char control[CMSG_SPACE(sizeof(fds))];
+    struct iovec iov = { (void *)line, strlen(line) + 1 };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    memset(control, 0, sizeof(control));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    if (sendmsg(conn, &msg, 0) == -1) {
+        perror("sendmsg");
+        close(conn);
+        return 0;
+    }
+
+    size_t received = 0;
+    while (received < sizeof(*reply)) {
+        ssize_t nbytes = read(conn, (char *)reply + received, sizeof(*reply) - received);
+        if (nbytes <= 0) {
+            fprintf(stderr, "Server closed the connection.\n");
+            close(conn);
+            return 0;
+        }
+        received += nbytes;
+    }
+    close(conn);
+    return 1;
+}
+
+double tv_ms(struct timeval *tv) {
+    return tv->tv_sec * 1000.0 + tv->tv_usec / 1000.0;
+}
+
+/***
+ * Sends the same line num_requests times from concurrency processes and
+ * prints the achieved requests per second.
+ * @param path
+ * @param line
+ * @param num_requests
+ * @param concurrency
+ * @return
+ */
+int run_benchmark(const char *path, const char *line, int num_requests, int concurrency) {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (int i = 0; i < concurrency; i++) {
+        pid_t pid = fork();
+        if (pid == -1) {
+            perror("fork");
+            return EXIT_FAILURE;
+        } else if (pid == 0) { // Child process
+            server_reply reply;
+            int share = num_requests / concurrency + (i < num_requests % concurrency);
+            for (int j = 0; j < share; j++) {
+                if (!send_request(path, line, &reply)) exit(EXIT_FAILURE);
+            }
+            exit(EXIT_SUCCESS);
+        }
+    }
+
+    int failed = 0;
+    int status;
+    while (wait(&status) > 0) {
+        failed |= !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    fprintf(stderr, "%d requests with %d clients in %.3f s: %.1f requests/sec\n",
+            num_requests, concurrency, seconds, num_requests / seconds);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+int main(int argc, char *argv[]) {
+    const char *socket_path = NULL;
+    int num_requests = 0;
+    int concurrency = 1;
+    int verbose = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:n:c:v")) != -1) {
+        switch (opt) {
+            case 's':
+                socket_path = optarg;
+                break;
+            case 'n':
+                num_requests = atoi(optarg);
+                break;
+            case 'c':
+                concurrency = atoi(optarg);
+                break;
+            case 'v':
+                verbose = 1;
+                break;
+            default:
+                socket_path = NULL;
+                optind = argc;
+                break;
+        }
+    }
+    if (socket_path == NULL || optind != argc - 1 || concurrency < 1) {
+        fprintf(stderr, "Usage: %s -s socket_path [-v] [-n requests [-c clients]] \"command line\"\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (num_requests > 0) {
+        return run_benchmark(socket_path, argv[optind], num_requests, concurrency);
+    }
+
+    server_reply reply;
+    if (!send_request(socket_path, argv[optind], &reply)) {
+        return EXIT_FAILURE;
+    }
+    if (verbose) {
+        fprintf(stderr, "status: %d, user: %.3f ms, system: %.3f ms, max rss: %ld KB\n", reply.status,
+                tv_ms(&reply.usage.ru_utime), tv_ms(&reply.usage.ru_stime), reply.usage.ru_maxrss);
+    }
+    return reply.status;
+}
@@ -0,0 +1,296 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include "expand.h"
+
+#define MAX_COMPONENTS 64
+
+struct linux_dirent64 {
+    ino64_t d_ino;
+    off64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+/***
+ * One path component of a pattern. A wildcard component is split at its stars, so
+ * matching is a check of the first and last segments followed by a leftmost search of the
+ * middle ones, which is correct because a star can take any number of characters.
+ */
+typedef struct {
+    char *text;          // The component itself, stars are replaced with NUL to separate segments
+    int is_wild;
+    int num_segments;
+    char *segments[MAX_ARGS];
+    size_t lengths[MAX_ARGS];
+    int starts_with_star;
+    int ends_with_star;
+    size_t min_length;   // Sum of segment lengths, shorter names are skipped at once
+} glob_component;
+
+typedef struct {
+    glob_component components[MAX_COMPONENTS];
+    int num_components;
+    int is_absolute;
+    int is_dir_only;     // The pattern ends with a slash, only directories match and keep the slash
+    char *copy;
+} glob_pattern;
+
+int has_glob(const char *arg) {
+    return strpbrk(arg, "*?") != NULL;
+}
+
+/***
+ * Compiles the pattern into components. Returns 0 if it has too many components or stars.
+ * @param pattern
+ * @param compiled
+ * @return
+ */
+int compile_pattern(const char *pattern, glob_pattern *compiled) {
+    memset(compiled, 0, sizeof(glob_pattern));
+    compiled->is_absolute = pattern[0] == '/';
+    compiled->is_dir_only = pattern[0] != '\0' && pattern[strlen(pattern) - 1] == '/';
+    compiled->copy = strdup(pattern);
+
+    char *save;
+    for (char *part = strtok_r(compiled->copy, "/", &save); part; part = strtok_r(NULL, "/", &save)) {
+        if (compiled->num_components == MAX_COMPONENTS) return 0;
+        glob_component *comp = &compiled->components[compiled->num_components++];
+        comp->text = part;
+        comp->is_wild = has_glob(part);
+        if (!comp->is_wild) continue;
+
+        size_t length = strlen(part);
+        comp->starts_with_star = part[0] == '*';
+        comp->ends_with_star = part[length - 1] == '*';
+        char *segment = part;
+        while (1) {
+            char *star = strchr(segment, '*');
+            if (star) *star = '\0';
+            if (*segment) {
+                if (comp->num_segments == MAX_ARGS) return 0;
+                comp->segments[comp->num_segments] = segment;
+                comp->lengths[comp->num_segments] = strlen(segment);
+                comp->min_length += comp->lengths[comp->num_segments];
+                comp->num_segments++;
+            }
+            if (!star) break;
+            segment = star + 1;
+        }
+    }
+    return 1;
+}
+
+int segment_equal(const char *name, const char *segment, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        if (segment[i] != '?' && segment[i] != name[i]) return 0;
+    }
+    return 1;
+}
+
+int match_component(const glob_component *comp, const char *name, size_t length) {
+    if (length < comp->min_length) return 0;
+    if (name[0] == '.' && comp->text[0] != '.') return 0;
+
+    int first = 0;
+    int last = comp->num_segments;
+    if (!comp->starts_with_star) {
+        if (last == 0 || !segment_equal(name, comp->segments[0], comp->lengths[0])) return 0;
+        name += comp->lengths[0];
+        length -= comp->lengths[0];
+        first = 1;
+        if (first == last) return comp->ends_with_star || length == 0;
+    }
+    if (!comp->ends_with_star && first < last) {
+        last--;
+        if (length < comp->lengths[last] ||
+            !segment_equal(name + length - comp->lengths[last], comp->segments[last], comp->lengths[last]))
+            return 0;
+        length -= comp->lengths[last];
+    }
+    for (int i = first; i < last; i++) {
+        size_t seg_length = comp->lengths[i];
+        while (length >= seg_length && !segment_equal(name, comp->segments[i], seg_length)) {
+            name++;
+            length--;
+        }
+        if (length < seg_length) return 0;
+        name += seg_length;
+        length -= seg_length;
+    }
+    return 1;
+}
+
+void add_match(glob_matches *matches, const char *path, size_t length) {
+    if (matches->used + length + 1 > matches->capacity) {
+        matches->capacity = (matches->used + length + 1) * 2;
+        matches->arena = (char *)realloc(matches->arena, matches->capacity);
+    }
+    if (matches->count == matches->max_count) {
+        matches->max_count = matches->max_count ? matches->max_count * 2 : 64;
+        matches->offsets = (size_t *)realloc(matches->offsets, matches->max_count * sizeof(size_t));
+    }
+    memcpy(matches->arena + matches->used, path, length);
+    matches->arena[matches->used + length] = '\0';
+    matches->offsets[matches->count++] = matches->used;
+    matches->used += length + 1;
+}
+
+int is_directory(const char *path) {
+    struct stat st;
+    return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+/***
+ * Adds a match of the last component. A pattern with a trailing slash only takes directories
+ * and the slash is kept on the match, like glob(3) does.
+ * @param pattern
+ * @param matches
+ * @param path
+ * @param length
+ * @param d_type DT_UNKNOWN if the type has to be looked up
+ */
+void add_last_match(const glob_pattern *pattern, glob_matches *matches, char *path, size_t length,
+                    unsigned char d_type) {
+    if (!pattern->is_dir_only) {
+        add_match(matches, path, length);
+        return;
+    }
+    if (d_type != DT_DIR && ((d_type != DT_UNKNOWN && d_type != DT_LNK) || !is_directory(path))) return;
+    if (length + 1 >= PATH_MAX) return;
+    path[length] = '/';
+    add_match(matches, path, length + 1);
+    path[length] = '\0';
+}
+
+/***
+ * Walks the components starting from index, path holds the directory built so far.
+ * @param pattern
+ * @param index
+ * @param path
+ * @param length
+ * @param buffer getdents64 buffer shared by every level
+ * @param matches
+ */
+void expand_component(const glob_pattern *pattern, int index, char *path, size_t length,
+                      char *buffer, glob_matches *matches) {
+    const glob_component *comp = &pattern->components[index];
+    int is_last = index == pattern->num_components - 1;
+    size_t prefix = length;
+    if (length > 0 && path[length - 1] != '/') path[prefix++] = '/';
+
+    if (!comp->is_wild) {
+        size_t comp_length = strlen(comp->text);
+        if (prefix + comp_length >= PATH_MAX) return;
+        memcpy(path + prefix, comp->text, comp_length + 1);
+        if (is_last) {
+            if (access(path, F_OK) == 0) add_last_match(pattern, matches, path, prefix + comp_length, DT_UNKNOWN);
+        } else {
+            expand_component(pattern, index + 1, path, prefix + comp_length, buffer, matches);
+        }
+        return;
+    }
+
+    path[prefix] = '\0';
+    int fd = open(prefix ? path : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) return;
+
+    // Entries that need a recursion are collected first since the buffer is shared
+    glob_matches dirs;
+    memset(&dirs, 0, sizeof(dirs));
+    long nbytes;
+    while ((nbytes = syscall(SYS_getdents64, fd, buffer, EXPAND_DIRENT_BUFFER_SIZE)) > 0) {
+        for (long pos = 0; pos < nbytes;) {
+            struct linux_dirent64 *entry = (struct linux_dirent64 *)(buffer + pos);
+            pos += entry->d_reclen;
+
+            const char *name = entry->d_name;
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) continue;
+            size_t name_length = strlen(name);
+            if (!match_component(comp, name, name_length)) continue;
+            if (prefix + name_length >= PATH_MAX) continue;
+
+            memcpy(path + prefix, name, name_length + 1);
+            if (is_last) {
+                add_last_match(pattern, matches, path, prefix + name_length, entry->d_type);
+            } else if (entry->d_type == DT_DIR ||
+                       ((entry->d_type == DT_UNKNOWN || entry->d_type == DT_LNK) && is_directory(path))) {
+                add_match(&dirs, path, prefix + name_length);
+            }
+        }
+    }
+    close(fd);
+
+    for (size_t i = 0; i < dirs.count; i++) {
+        size_t dir_length = strlen(dirs.arena + dirs.offsets[i]);
+        memcpy(path, dirs.arena + dirs.offsets[i], dir_length + 1);
+        expand_component(pattern, index + 1, path, dir_length, buffer, matches);
+    }
+    free_matches(&dirs);
+}
+
+static const char *sort_arena;
+
+int compare_matches(const void *a, const void *b) {
+    return strcmp(sort_arena + *(const size_t *)a, sort_arena + *(const size_t *)b);
+}
+
+size_t expand_pattern(const char *pattern, glob_matches *matches) {
+    glob_pattern compiled;
+    memset(matches, 0, sizeof(glob_matches));
+    if (!compile_pattern(pattern, &compiled) || compiled.num_components == 0) {
+        free(compiled.copy);
+        return 0;
+    }
+
+    char path[PATH_MAX];
+    char *buffer = (char *)malloc(EXPAND_DIRENT_BUFFER_SIZE);
+    size_t length = 0;
+    if (compiled.is_absolute) path[length++] = '/';
+    path[length] = '\0';
+    expand_component(&compiled, 0, path, length, buffer, matches);
+    free(buffer);
+    free(compiled.copy);
+
+    sort_arena = matches->arena;
+    qsort(matches->offsets, matches->count, sizeof(size_t), compare_matches);
+    return matches->count;
+}
+
+void free_matches(glob_matches *matches) {
+    free(matches->arena);
+    free(matches->offsets);
+    memset(matches, 0, sizeof(glob_matches));
+}
+
+char **expand_args(command *cmd) {
+    size_t num_args = 0;
+    size_t max_args = MAX_ARGS;
+    char **args = (char **)malloc(max_args * sizeof(char *));
+
+    for (int i = 0; i < MAX_ARGS && cmd->args[i]; i++) {
+        glob_matches matches;
+        size_t count = 0;
+        if (!(cmd->quoted & (1u << i)) && has_glob(cmd->args[i])) {
+            count = expand_pattern(cmd->args[i], &matches);
+        }
+        if (num_args + count + 2 > max_args) {
+            max_args = (num_args + count + 2) * 2;
+            args = (char **)realloc(args, max_args * sizeof(char *));
+        }
+        if (count == 0) {
+            args[num_args++] = cmd->args[i];
+            continue;
+        }
+        for (size_t j = 0; j < count; j++) {
+            args[num_args++] = matches.arena + matches.offsets[j]; // the arena is kept until exec
+        }
+    }
+    args[num_args] = NULL;
+    return args;
+}
@@ -0,0 +1,55 @@
+#ifndef EXPAND_H
+#define EXPAND_H
+
+#include "parser.h"
+
+#define EXPAND_DIRENT_BUFFER_SIZE (1024 * 1024) // Bytes asked from getdents64 at once
+
+/***
+ * Matches of one pattern. Names are stored back to back in a single arena
+ * so that expanding large directories does not allocate per entry.
+ */
+typedef struct {
+    char *arena;      // NUL separated matched paths
+    size_t used;
+    size_t capacity;
+    size_t *offsets;  // Start of every match inside the arena
+    size_t count;
+    size_t max_count;
+} glob_matches;
+
+/***
+ * Returns 1 if the argument contains * or ?.
+ * @param arg
+ * @return
+ */
+int has_glob(const char *arg);
+
+/***
+ * Expands the pattern by reading the directories it walks with getdents64.
+ * Each path component is compiled once and d_type is used instead of stat whenever it is known.
+ * Matches are sorted. Names starting with a dot only match a pattern that starts with a dot.
+ * A pattern ending with a slash only matches directories, which keep the slash.
+ * It returns the number of matches.
+ * @param pattern
+ * @param matches
+ * @return
+ */
+size_t expand_pattern(const char *pattern, glob_matches *matches);
+
+/***
+ * Frees the arena and the offsets of the matches.
+ * @param matches
+ */
+void free_matches(glob_matches *matches);
+
+/***
+ * Builds a new null-terminated argument vector for the command where every unquoted
+ * argument with * or ? is replaced by its matches, or kept as it is if nothing matches.
+ * It is meant to be called right before exec, the result is not freed.
+ * @param cmd
+ * @return
+ */
+char **expand_args(command *cmd);
+
+#endif //EXPAND_H
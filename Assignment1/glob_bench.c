@@ -0,0 +1,59 @@
+#include <glob.h>
+#include <time.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "expand.h"
+
+double now_ms() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+}
+
+// Creates num_files empty files named file<i>.txt / file<i>.dat in dir if it does not exist yet
+void populate(const char *dir, long num_files) {
+    char path[PATH_MAX];
+    if (mkdir(dir, 0755) == -1) return;
+    for (long i = 0; i < num_files; i++) {
+        snprintf(path, sizeof(path), "%s/file%ld.%s", dir, i, i % 2 ? "dat" : "txt");
+        int fd = open(path, O_CREAT | O_WRONLY, 0644);
+        if (fd != -1) close(fd);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s directory pattern [num_files [rounds]]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    long num_files = argc > 3 ? atol(argv[3]) : 0;
+    int rounds = argc > 4 ? atoi(argv[4]) : 5;
+    if (num_files > 0) populate(argv[1], num_files);
+
+    char pattern[PATH_MAX];
+    snprintf(pattern, sizeof(pattern), "%s/%s", argv[1], argv[2]);
+
+    double start = now_ms();
+    size_t count = 0;
+    for (int i = 0; i < rounds; i++) {
+        glob_matches matches;
+        count = expand_pattern(pattern, &matches);
+        free_matches(&matches);
+    }
+    double expand_time = (now_ms() - start) / rounds;
+
+    start = now_ms();
+    size_t glob_count = 0;
+    for (int i = 0; i < rounds; i++) {
+        glob_t result;
+        glob_count = glob(pattern, 0, NULL, &result) == 0 ? result.gl_pathc : 0;
+        globfree(&result);
+    }
+    double glob_time = (now_ms() - start) / rounds;
+
+    printf("expand_pattern: %zu matches in %.3f ms\n", count, expand_time);
+    printf("glob(3):        %zu matches in %.3f ms\n", glob_count, glob_time);
+    return count == glob_count ? EXIT_SUCCESS : EXIT_FAILURE;
+}
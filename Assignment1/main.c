@@ -1,7 +1,48 @@
+#define _GNU_SOURCE
 #include <sys/wait.h>
 #include <unistd.h>
 #include <signal.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+#include <time.h>
 #include "parser.h"
+#include "server.h"
+#include "expand.h"
+#include "cache.h"
+
+#define METER_SPLICE_SIZE (64 * 1024)
+
+#define REPEATER_BUFFER_SIZE (256 * 1024)
+#define SPLIT_CHUNK_SIZE (16 * 1024) // Most bytes of whole records a branch gets in one write
+
+// Set from ESHELL_PIPE_METER, relays every pipeline hop through a metering process.
+int pipe_meter = 0;
+// Set from ESHELL_PARALLEL_MODE and ESHELL_PARALLEL_DELIM, decides how the stdin of a
+// parallel subshell is given to its branches when its separators are plain commas.
+DISTRIBUTION_MODE distribution_mode = DISTRIBUTE_BROADCAST;
+char record_delim = '\n';
+// Exit code of the last command that is waited for, reported back to server clients.
+int last_status = 0;
+
+int exit_code(int status) {
+    if (WIFSIGNALED(status)) {
+        return 128 + WTERMSIG(status);
+    }
+    return WEXITSTATUS(status);
+}
+
+// Reaps every child, the exit code is taken from last_pid only, since meter relays and
+// earlier stages may finish in any order.
+void wait_children(pid_t last_pid) {
+    int status;
+    pid_t pid;
+    while ((pid = wait(&status)) > 0) {
+        if (pid == last_pid) {
+            last_status = exit_code(status);
+        }
+    }
+}
 
 void handle_pipeline(single_input *pipe_input);
 void handle_subshell_command(parsed_input *input);
@@ -10,6 +51,30 @@ void handle_subshell_pipe(single_input *input);
 void handle_subshell_command_pipe(parsed_input *input);
 void handle_parallel_subshell(parsed_input *input);
 
+// Opens the redirected files and places them on stdin/stdout of the calling child.
+void apply_redirection(redirection *redir) {
+    int fd;
+    if (redir->input_file) {
+        fd = open(redir->input_file, O_RDONLY);
+        if (fd == -1) {
+            perror(redir->input_file);
+            exit(EXIT_FAILURE);
+        }
+        dup2(fd, STDIN_FILENO);
+        close(fd);
+    }
+    if (redir->output_file) {
+        int flags = O_WRONLY | O_CREAT | (redir->output_mode == REDIRECT_APPEND ? O_APPEND : O_TRUNC);
+        fd = open(redir->output_file, flags, 0644);
+        if (fd == -1) {
+            perror(redir->output_file);
+            exit(EXIT_FAILURE);
+        }
+        dup2(fd, STDOUT_FILENO);
+        close(fd);
+    }
+}
+
 void handle_command(single_input *input){
     if (input == NULL || input->data.cmd.args[0] == NULL) {
         fprintf(stderr, "Invalid command.\n");
@@ -21,7 +86,13 @@ void handle_command(single_input *input){
     if (pid == -1) {
         perror("fork");
     } else if (pid == 0) {// Child process
-        if (execvp(input->data.cmd.args[0], input->data.cmd.args) == -1) {
+        apply_redirection(&input->data.cmd.redir);
+        char **args = expand_args(&input->data.cmd);
+        if (is_cached_command(args)) {
+            fflush(stdout);
+            _exit(run_cached(args)); // exit would move the offset of a stdin shared with the shell
+        }
+        if (exec_command(args) == -1) {
             perror("execvp");
             exit(EXIT_FAILURE);
         }
@@ -30,6 +101,7 @@ void handle_command(single_input *input){
         do {
             waitpid(pid, &status, WUNTRACED);
         } while (!WIFEXITED(status) && !WIFSIGNALED(status));
+        last_status = exit_code(status);
     }
 }
 
@@ -53,8 +125,94 @@ void handle_sequential(parsed_input *input){
     }
 }
 
+double elapsed_ms(struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000.0 + (now.tv_nsec - start->tv_nsec) / 1000000.0;
+}
+
+// Moves data from in to out with splice and reports the hop statistics to stderr at EOF.
+// Time spent waiting for input means the reader was starved, time spent waiting for
+// output means the writer was backpressured.
+void meter_logic(int in, int out, int hop, const char *from, const char *to) {
+    signal(SIGPIPE, SIG_IGN);
+    struct pollfd in_poll = { in, POLLIN, 0 };
+    struct pollfd out_poll = { out, POLLOUT, 0 };
+    struct timespec start, wait_start;
+    unsigned long long bytes = 0;
+    double starved = 0, backpressured = 0;
+    ssize_t nbytes;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (1) {
+        clock_gettime(CLOCK_MONOTONIC, &wait_start);
+        poll(&in_poll, 1, -1);
+        starved += elapsed_ms(&wait_start);
+
+        nbytes = splice(in, NULL, out, NULL, METER_SPLICE_SIZE, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (nbytes > 0) {
+            bytes += nbytes;
+        } else if (nbytes == -1 && errno == EAGAIN) {
+            clock_gettime(CLOCK_MONOTONIC, &wait_start);
+            poll(&out_poll, 1, -1);
+            backpressured += elapsed_ms(&wait_start);
+        } else if (nbytes == -1 && errno == EINTR) {
+            continue;
+        } else {
+            break; // EOF from the writer or the reader is gone
+        }
+    }
+
+    double total = elapsed_ms(&start);
+    fprintf(stderr, "[meter] hop %d %s -> %s: %llu bytes in %.3f ms (%.2f MB/s), "
+                    "reader starved %.3f ms, writer backpressured %.3f ms\n",
+            hop, from, to, bytes, total, total > 0 ? bytes / total / 1000.0 : 0.0,
+            starved, backpressured);
+}
+
+// Puts a metering relay in the middle of the pipe fd. Afterwards fd[1] is still the
+// writer's end and fd[0] is the read end of the relay's output pipe.
+void meter_hop(int fd[2], int in_fd, int hop, const char *from, const char *to) {
+    int relay[2];
+    if (pipe(relay) == -1) {
+        perror("pipe");
+        exit(EXIT_FAILURE);
+    }
+
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("fork");
+        exit(EXIT_FAILURE);
+    } else if (pid == 0) { // Relay process
+        close(fd[1]);
+        close(relay[0]);
+        if (in_fd != 0) {
+            close(in_fd);
+        }
+        meter_logic(fd[0], relay[1], hop, from, to);
+        exit(EXIT_SUCCESS);
+    }
+
+    close(fd[0]);
+    close(relay[1]);
+    fd[0] = relay[0];
+}
+
+const char *input_name(single_input *input) {
+    if (input->type == INPUT_TYPE_SUBSHELL) {
+        return "(subshell)";
+    }
+    return input->data.cmd.args[0];
+}
+
 void execute_command(command *cmd) {
-    if (execvp(cmd->args[0], cmd->args) == -1) {
+    apply_redirection(&cmd->redir);
+    char **args = expand_args(cmd);
+    if (is_cached_command(args)) {
+        fflush(stdout);
+        _exit(run_cached(args)); // exit would move the offset of a stdin shared with the shell
+    }
+    if (exec_command(args) == -1) {
         perror("execvp");
         exit(0);
     }
@@ -64,6 +222,7 @@ void handle_pipeline(single_input *pipe_input) {
     int i;
     int in_fd = 0;
     int fd[2];
+    pid_t last_pid = -1;
 
     for (i = 0; i < pipe_input->data.pline.num_commands; i++) {
 
@@ -72,6 +231,10 @@ void handle_pipeline(single_input *pipe_input) {
                 perror("pipe");
                 exit(EXIT_FAILURE);
             }
+            if (pipe_meter) {
+                meter_hop(fd, in_fd, i + 1, pipe_input->data.pline.commands[i].args[0],
+                          pipe_input->data.pline.commands[i + 1].args[0]);
+            }
         }
 
         pid_t pid = fork();
@@ -94,6 +257,7 @@ void handle_pipeline(single_input *pipe_input) {
             execute_command(pipe_input->data.pline.commands + i);
             exit(EXIT_FAILURE);
         } else { // Parent process
+            last_pid = pid;
             if (in_fd != 0) {
                 close(in_fd);
             }
@@ -107,13 +271,14 @@ void handle_pipeline(single_input *pipe_input) {
             }
         }
     }
-    while (wait(NULL) > 0);
+    wait_children(last_pid);
 }
 
 void handle_pipeline_standalone(parsed_input *input){
     int i;
     int in_fd = 0; 
     int fd[2];     
+    pid_t last_pid = -1;
     for (i = 0; i < input->num_inputs; i++) {
        
         if (i < input->num_inputs - 1) {
@@ -121,6 +286,10 @@ void handle_pipeline_standalone(parsed_input *input){
                 perror("pipe");
                 exit(EXIT_FAILURE);
             }
+            if (pipe_meter) {
+                meter_hop(fd, in_fd, i + 1, input_name(&(input->inputs[i])),
+                          input_name(&(input->inputs[i + 1])));
+            }
         }
 
         pid_t pid = fork();
@@ -142,13 +311,16 @@ void handle_pipeline_standalone(parsed_input *input){
             }
             
             if(input->inputs[i].type == INPUT_TYPE_SUBSHELL){
+                apply_redirection(&(input->inputs[i].redir));
                 handle_subshell_pipe(&(input->inputs[i]));
+                exit(last_status);
             } else {
                 execute_command(&(input->inputs[i].data.cmd));
             }
 
             exit(EXIT_FAILURE); 
         } else { // Parent process
+            last_pid = pid;
             if (in_fd != 0) {
                 close(in_fd); 
             }
@@ -163,7 +335,7 @@ void handle_pipeline_standalone(parsed_input *input){
         }
     }
 
-    while (wait(NULL) > 0);
+    wait_children(last_pid);
 }
 
 void handle_parallel(parsed_input *input) {
@@ -188,6 +360,7 @@ void handle_parallel(parsed_input *input) {
             }
             else if (input->inputs[i].type == INPUT_TYPE_PIPELINE) {
                 handle_pipeline(&(input->inputs[i]));
+                exit(last_status);
             }
             else {
                 fprintf(stderr, "Unsupported input type in parallel execution.\n");
@@ -197,8 +370,9 @@ void handle_parallel(parsed_input *input) {
     }
 
     for (i = 0; i < num_commands; i++) {
-        if (pids[i] > 0) {
-            waitpid(pids[i], NULL, 0);
+        int status;
+        if (pids[i] > 0 && waitpid(pids[i], &status, 0) > 0) {
+            last_status = exit_code(status);
         }
     }
 }
@@ -215,15 +389,20 @@ void handle_subshell(single_input *input) {
         perror("fork");
     } else if (pid == 0) { // Child process
 
+        apply_redirection(&input->redir);
         parsed_input subshell_input;
         if (parse_line(input->data.subshell, &subshell_input)) {
             handle_subshell_command(&subshell_input);
+            exit(last_status);
         } else {
             fprintf(stderr, "Subshell command parsing failed.\n");
         }
         exit(EXIT_FAILURE);
     } else { // Parent process
-        waitpid(pid, NULL, 0);
+        int status;
+        if (waitpid(pid, &status, 0) > 0) {
+            last_status = exit_code(status);
+        }
     }
 }
 
@@ -283,7 +462,7 @@ void handle_subshell_command_pipe(parsed_input *input){
 
 void repeater_logic(int *write_fds, int num_commands) {
     signal(SIGPIPE, SIG_IGN);
-    char buffer[256 * 1024];
+    char buffer[REPEATER_BUFFER_SIZE];
     ssize_t nbytes;
 
     while ((nbytes = read(STDIN_FILENO, buffer, sizeof(buffer))) > 0) {
@@ -293,12 +472,128 @@ void repeater_logic(int *write_fds, int num_commands) {
     }
 }
 
+// Writes the whole buffer, returns -1 if the branch cannot take more input.
+int write_all(int fd, const char *buffer, size_t size) {
+    while (size > 0) {
+        ssize_t nbytes = write(fd, buffer, size);
+        if (nbytes == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        buffer += nbytes;
+        size -= nbytes;
+    }
+    return 0;
+}
+
+// Picks the branch that receives the next chunk of records, -1 if every branch is gone.
+int next_branch(int *write_fds, int num_commands, int last, DISTRIBUTION_MODE mode) {
+    if (mode == DISTRIBUTE_READY) {
+        struct pollfd polls[num_commands];
+        for (int i = 0; i < num_commands; ++i) {
+            polls[i].fd = write_fds[i]; // negative fds are ignored by poll
+            polls[i].events = POLLOUT;
+            polls[i].revents = 0;
+        }
+        while (1) {
+            int open = 0;
+            for (int i = 0; i < num_commands; ++i) {
+                if (polls[i].fd >= 0) open++;
+            }
+            if (open == 0) return -1; // poll would wait forever on nothing
+            int ready = poll(polls, num_commands, -1);
+            if (ready == -1 && errno == EINTR) continue;
+            if (ready <= 0) return -1;
+            for (int i = 1; i <= num_commands; ++i) { // ready branches take turns
+                int branch = (last + i) % num_commands;
+                if (polls[branch].revents & POLLOUT) return branch;
+            }
+            for (int i = 0; i < num_commands; ++i) {
+                if (polls[i].revents) polls[i].fd = -1; // POLLERR, the reader is gone
+            }
+        }
+        return -1;
+    }
+    for (int i = 1; i <= num_commands; ++i) {
+        int branch = (last + i) % num_commands;
+        if (write_fds[branch] >= 0) return branch;
+    }
+    return -1;
+}
+
+// Splits stdin between the branches instead of repeating it. The records that are read are
+// handed out in chunks of at most SPLIT_CHUNK_SIZE bytes and at most an equal share of the
+// read, so a small input still reaches every branch. A chunk only holds whole records, a
+// record that is longer than a chunk goes to one branch by itself, even over several writes.
+void splitter_logic(int *write_fds, int num_commands, DISTRIBUTION_MODE mode) {
+    signal(SIGPIPE, SIG_IGN);
+    char buffer[REPEATER_BUFFER_SIZE];
+    int fds[num_commands];
+    size_t used = 0;
+    int branch = -1;
+    int in_record = 0; // the last write ended inside a record, its rest goes to the same branch
+    ssize_t nbytes;
+
+    memcpy(fds, write_fds, sizeof(fds)); // closed branches are marked with -1 here
+    while (1) {
+        nbytes = read(STDIN_FILENO, buffer + used, sizeof(buffer) - used);
+        if (nbytes == -1 && errno == EINTR) continue;
+        if (nbytes <= 0) break;
+        used += nbytes;
+
+        size_t complete = used; // end of the last whole record
+        while (complete > 0 && buffer[complete - 1] != record_delim) complete--;
+        size_t limit = complete / num_commands + 1;
+        if (limit > SPLIT_CHUNK_SIZE) limit = SPLIT_CHUNK_SIZE;
+
+        size_t start = 0;
+        while (start < complete) {
+            size_t end;
+            if (in_record) {
+                end = (char *)memchr(buffer + start, record_delim, complete - start) - buffer + 1;
+            } else {
+                branch = next_branch(fds, num_commands, branch, mode);
+                if (branch == -1) return;
+                end = start + limit < complete ? start + limit : complete;
+                while (end > start && buffer[end - 1] != record_delim) end--;
+                if (end == start) { // the first record is longer than a chunk
+                    end = (char *)memchr(buffer + start + limit, record_delim, complete - start - limit) - buffer + 1;
+                }
+            }
+            if (write_all(fds[branch], buffer + start, end - start) == -1) {
+                fds[branch] = -1; // the records of a closed branch are lost like in broadcast
+            }
+            in_record = 0;
+            start = end;
+        }
+
+        if (complete == 0 && used == sizeof(buffer)) { // a record that does not fit into the buffer
+            if (!in_record) {
+                branch = next_branch(fds, num_commands, branch, mode);
+                if (branch == -1) return;
+            }
+            if (write_all(fds[branch], buffer, used) == -1) {
+                fds[branch] = -1;
+            }
+            in_record = 1;
+            complete = used;
+        }
+        memmove(buffer, buffer + complete, used - complete);
+        used -= complete;
+    }
+
+    if (used > 0) { // the last record has no delimiter
+        if (!in_record) branch = next_branch(fds, num_commands, branch, mode);
+        if (branch != -1) write_all(fds[branch], buffer, used);
+    }
+}
+
 void handle_parallel_subshell(parsed_input *input) {
     if (input == NULL || input->num_inputs == 0) return;
 
     int num_commands = input->num_inputs;
     int write_fds[num_commands];
-    pid_t pid;
+    pid_t pid = -1;
     for (int i = 0; i < num_commands; ++i) {
         int fds[2];
         if (pipe(fds) < 0) {
@@ -314,11 +609,15 @@ void handle_parallel_subshell(parsed_input *input) {
             close(fds[1]);
             dup2(fds[0], STDIN_FILENO);
             close(fds[0]);
+            for (int j = 0; j < i; ++j) {
+                close(write_fds[j]); // so earlier branches see EOF as soon as the parent closes them
+            }
 
             if (input->inputs[i].type == INPUT_TYPE_COMMAND) {
                 execute_command(&(input->inputs[i].data.cmd));
             } else if(input->inputs[i].type == INPUT_TYPE_PIPELINE) {
                 handle_pipeline(&(input->inputs[i]));
+                exit(last_status);
             }
             exit(EXIT_FAILURE);
         } else { // Parent process
@@ -328,18 +627,87 @@ void handle_parallel_subshell(parsed_input *input) {
     }
 
     if(pid > 0) {
-        repeater_logic(write_fds, num_commands);
+        DISTRIBUTION_MODE mode = input->distribution != DISTRIBUTE_DEFAULT ? input->distribution : distribution_mode;
+        if (mode == DISTRIBUTE_BROADCAST) {
+            repeater_logic(write_fds, num_commands);
+        } else {
+            splitter_logic(write_fds, num_commands, mode);
+        }
 
         for (int j = 0; j < num_commands; ++j) {
             close(write_fds[j]);
         }
 
-        while (wait(NULL) > 0);
+        wait_children(pid);
     }
 }
 
-int main() {
+void execute_input(parsed_input *input) {
+    switch (input->separator) {
+        case SEPARATOR_PIPE:
+            handle_pipeline_standalone(input);
+            break;
+        case SEPARATOR_SEQ:
+            handle_sequential(input);
+            break;
+        case SEPARATOR_PARA:
+            handle_parallel(input);
+            break;
+        default:
+            if (input->num_inputs == 1 && input->inputs[0].type == INPUT_TYPE_COMMAND) {
+                handle_command(&input->inputs[0]);
+            } else if (input->num_inputs == 1 && input->inputs[0].type == INPUT_TYPE_SUBSHELL) {
+                handle_subshell(&input->inputs[0]);
+            }
+            break;
+    }
+}
+
+// Runs one line for a server client and returns its exit code.
+int execute_line(char *line) {
+    parsed_input input;
+    if (!parse_line(line, &input)) {
+        return EXIT_FAILURE;
+    }
+    execute_input(&input);
+    free_parsed_input(&input);
+    return last_status;
+}
+
+int main(int argc, char *argv[]) {
     char line[INPUT_BUFFER_SIZE];
+    const char *socket_path = NULL;
+    int max_workers = SERVER_DEFAULT_WORKERS;
+    int opt;
+    char *meter = getenv("ESHELL_PIPE_METER");
+    pipe_meter = meter != NULL && strcmp(meter, "0") != 0;
+    char *mode = getenv("ESHELL_PARALLEL_MODE");
+    if (mode != NULL && strcmp(mode, "roundrobin") == 0) {
+        distribution_mode = DISTRIBUTE_ROUND_ROBIN;
+    } else if (mode != NULL && strcmp(mode, "ready") == 0) {
+        distribution_mode = DISTRIBUTE_READY;
+    }
+    char *delim = getenv("ESHELL_PARALLEL_DELIM");
+    if (delim != NULL && delim[0] != '\0') {
+        record_delim = delim[0];
+    }
+
+    while ((opt = getopt(argc, argv, "s:j:")) != -1) {
+        switch (opt) {
+            case 's':
+                socket_path = optarg;
+                break;
+            case 'j':
+                max_workers = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-s socket_path [-j max_workers]]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (socket_path != NULL) {
+        return run_server(socket_path, max_workers > 0 ? max_workers : 1, execute_line);
+    }
 
     while (1) {
         printf("/> ");
@@ -363,25 +731,7 @@ int main() {
         parsed_input input;
 
         if (parse_line(line, &input)) {
-            
-            switch (input.separator) {
-                case SEPARATOR_PIPE:
-                    handle_pipeline_standalone(&input);
-                    break;
-                case SEPARATOR_SEQ:
-                    handle_sequential(&input);
-                    break;
-                case SEPARATOR_PARA:
-                    handle_parallel(&input);
-                    break;
-                default:
-                    if (input.num_inputs == 1 && input.inputs[0].type == INPUT_TYPE_COMMAND) {
-                        handle_command(&input.inputs[0]);
-                    } else if (input.num_inputs == 1 && input.inputs[0].type == INPUT_TYPE_SUBSHELL) {
-                        handle_subshell(&input.inputs[0]);
-                    }
-                    break;
-            }
+            execute_input(&input);
         } else {
             continue;
         }
@@ -1,5 +1,8 @@
+#include <limits.h>
 #include "parser.h"
 
+_Static_assert(MAX_ARGS <= sizeof(((command *)0)->quoted) * CHAR_BIT, "command.quoted needs a bit for every argument");
+
 /***
  * Checks whether the inputs contain a subshell to
  * prevent subshells being chained with a seq or para separator
@@ -25,8 +28,13 @@ void convert_to_pipeline(parsed_input* input) {
     memset(&pipeline1, 0, sizeof(pipeline));
 
     pipeline1.num_commands = input->num_inputs;
-    for ( int i=0; i<input->num_inputs; i++ )
+    for ( int i=0; i<input->num_inputs; i++ ) {
         memcpy(pipeline1.commands[i].args, input->inputs[i].data.cmd.args, MAX_INPUTS*sizeof(char*));
+        pipeline1.commands[i].redir = input->inputs[i].data.cmd.redir;
+        pipeline1.commands[i].quoted = input->inputs[i].data.cmd.quoted;
+        // Redirections are moved into the pipeline, so the reused inputs should not keep them
+        memset(&(input->inputs[i].data.cmd.redir), 0, sizeof(redirection));
+    }
 
     input->num_inputs = 1;
     input->inputs[0].type = INPUT_TYPE_PIPELINE;
@@ -43,18 +51,34 @@ void convert_command_to_pipeline(parsed_input* input) {
     memset(&pipeline1, 0, sizeof(pipeline));
     pipeline1.num_commands = 1;
     memcpy(pipeline1.commands[0].args, input->inputs[input_index].data.cmd.args, MAX_INPUTS*sizeof(char*));
+    pipeline1.commands[0].redir = input->inputs[input_index].data.cmd.redir;
+    pipeline1.commands[0].quoted = input->inputs[input_index].data.cmd.quoted;
 
     input->inputs[input_index].type = INPUT_TYPE_PIPELINE;
     memcpy(&(input->inputs[input_index].data.pline), &pipeline1, sizeof(pipeline));
 }
 
+/***
+ * Sets or clears the quoted flag of the argument
+ * @param cmd
+ * @param arg_index
+ * @param is_quoted
+ */
+void mark_quoted(command *cmd, int arg_index, int is_quoted) {
+    if ( is_quoted )
+        cmd->quoted |= 1u << arg_index;
+    else
+        cmd->quoted &= ~(1u << arg_index);
+}
+
 /***
  * Fills the current input's command or argument with the current buffer
  * @param input
  * @param buffer
  * @param is_command
+ * @param is_quoted Quoted arguments are marked so they are not glob expanded
  */
-void write_buffer(parsed_input* input, char *buffer, int is_command, int is_pipeline) {
+void write_buffer(parsed_input* input, char *buffer, int is_command, int is_pipeline, int is_quoted) {
     int input_index;
     int arg_index;
     int current_command;
@@ -83,6 +107,7 @@ void write_buffer(parsed_input* input, char *buffer, int is_command, int is_pipe
         strcpy(input->inputs[input_index].data.pline.commands[current_command].args[arg_index],
                buffer);
         input->inputs[input_index].data.pline.commands[current_command].args[arg_index+1] = NULL;
+        mark_quoted(&(input->inputs[input_index].data.pline.commands[current_command]), arg_index, is_quoted);
         if ( is_command )
             input->inputs[input_index].data.pline.num_commands++;
     }
@@ -91,11 +116,67 @@ void write_buffer(parsed_input* input, char *buffer, int is_command, int is_pipe
         input->inputs[input_index].data.cmd.args[arg_index] = (char *)calloc(strlen(buffer), sizeof(char));
         strcpy(input->inputs[input_index].data.cmd.args[arg_index], buffer);
         input->inputs[input_index].data.cmd.args[arg_index+1] = NULL;
+        mark_quoted(&(input->inputs[input_index].data.cmd), arg_index, is_quoted);
         if ( is_command )
             input->num_inputs++;
     }
 }
 
+/***
+ * Stores the current buffer as the file of a redirection
+ * If it comes after a subshell, it belongs to the subshell, otherwise to the last command that is read
+ * @param input
+ * @param buffer
+ * @param redir_char
+ * @param is_append
+ * @param is_subshell_redir
+ */
+void write_redirection(parsed_input* input, char *buffer, char redir_char, int is_append, int is_subshell_redir) {
+    int input_index = input->num_inputs-1;
+    redirection *redir;
+    if ( is_subshell_redir )
+        redir = &(input->inputs[input_index].redir);
+    else if ( input->inputs[input_index].type == INPUT_TYPE_PIPELINE )
+        redir = &(input->inputs[input_index].data.pline.commands[input->inputs[input_index].data.pline.num_commands-1].redir);
+    else
+        redir = &(input->inputs[input_index].data.cmd.redir);
+
+    if ( redir_char == '<' ) {
+        free(redir->input_file);
+        redir->input_file = strdup(buffer);
+    }
+    else {
+        free(redir->output_file);
+        redir->output_file = strdup(buffer);
+        redir->output_mode = is_append ? REDIRECT_APPEND : REDIRECT_TRUNCATE;
+    }
+}
+
+/***
+ * Reads the distribution marker right after a parallel separator. ",%" splits stdin round-robin,
+ * ",?" gives it to the branch that is ready first and a plain "," leaves the default.
+ * Every parallel separator of the input should use the same marker.
+ * @param input
+ * @param current_char Points at the comma, it is moved onto the marker if there is one
+ * @return 0 if the marker differs from the earlier separators
+ */
+int read_distribution(parsed_input* input, char **current_char) {
+    DISTRIBUTION_MODE mode = DISTRIBUTE_DEFAULT;
+    if ( *(*current_char+1) == '%' )
+        mode = DISTRIBUTE_ROUND_ROBIN;
+    else if ( *(*current_char+1) == '?' )
+        mode = DISTRIBUTE_READY;
+    if ( mode != DISTRIBUTE_DEFAULT )
+        (*current_char)++;
+
+    if ( input->separator == SEPARATOR_PARA && input->distribution != mode ) {
+        fprintf(stderr, "Parallel separators should all use the same distribution.\n");
+        return 0;
+    }
+    input->distribution = mode;
+    return 1;
+}
+
 int parse_line(char *line, parsed_input *input) {
     char *current_char;
     int buffer_index = 0;
@@ -119,6 +200,12 @@ int parse_line(char *line, parsed_input *input) {
     int is_reading_arg = 0;
 
     int is_pipeline = 0;
+
+    int is_waiting_redir = 0;
+    int is_reading_redir = 0;
+    int is_subshell_redir = 0;
+    int is_append = 0;
+    char redir_char = 0;
     while ( *current_char ) {
         if ( is_quote ) {
             if ( *current_char == quote_char ) {
@@ -126,10 +213,20 @@ int parse_line(char *line, parsed_input *input) {
                 buffer_index = 0;
                 is_quote = 0;
                 quote_char = 0;
-                write_buffer(input, buffer, is_reading_command, is_pipeline);
-                is_reading_command = 0;
-                is_reading_arg = 0;
-                is_waiting_arg = 1;
+                if ( is_reading_redir ) {
+                    write_redirection(input, buffer, redir_char, is_append, is_subshell_redir);
+                    is_reading_redir = 0;
+                    if ( is_subshell_redir )
+                        is_waiting_sep = 1;
+                    else
+                        is_waiting_arg = 1;
+                }
+                else {
+                    write_buffer(input, buffer, is_reading_command, is_pipeline, 1);
+                    is_reading_command = 0;
+                    is_reading_arg = 0;
+                    is_waiting_arg = 1;
+                }
                 is_free = 1;
             }
             else {
@@ -161,7 +258,38 @@ int parse_line(char *line, parsed_input *input) {
                 current_char++;
                 continue;
             }
-            if ( is_waiting_command ) {
+            if ( (is_waiting_arg || is_waiting_sep) && (*current_char == '<' || *current_char == '>') ) {
+                redir_char = *current_char;
+                is_append = 0;
+                if ( *current_char == '>' && *(current_char+1) == '>' ) {
+                    is_append = 1;
+                    current_char++;
+                }
+                is_subshell_redir = is_waiting_sep;
+                is_waiting_arg = 0;
+                is_waiting_sep = 0;
+                is_waiting_redir = 1;
+            }
+            else if ( is_waiting_redir ) {
+                if ( *current_char == '"' || *current_char == '\'') {
+                    is_free = 0;
+                    is_quote = 1;
+                    quote_char = *current_char;
+                    is_waiting_redir = 0;
+                    is_reading_redir = 1;
+                }
+                else if ( strchr(";,|<>()", *current_char) ) {
+                    fprintf(stderr, "There should be a file name after redirection.\n");
+                    return 0;
+                }
+                else {
+                    is_free = 0;
+                    is_waiting_redir = 0;
+                    is_reading_redir = 1;
+                    buffer[buffer_index++] = *current_char;
+                }
+            }
+            else if ( is_waiting_command ) {
                 if ( *current_char == '"' || *current_char == '\'') {
                     is_free = 0;
                     is_quote = 1;
@@ -235,6 +363,8 @@ int parse_line(char *line, parsed_input *input) {
                         }
                         convert_to_pipeline(input);
                     }
+                    if ( !read_distribution(input, &current_char) )
+                        return 0;
                     input->separator = SEPARATOR_PARA;
                     is_waiting_arg = 0;
                     is_waiting_command = 1;
@@ -297,14 +427,35 @@ int parse_line(char *line, parsed_input *input) {
                 }
             }
         }
+        else if ( is_reading_redir ) {
+            if ( isspace(*current_char) || strchr(";,|<>", *current_char) ) {
+                buffer[buffer_index] = '\0';
+                write_redirection(input, buffer, redir_char, is_append, is_subshell_redir);
+                buffer_index = 0;
+                is_reading_redir = 0;
+                if ( is_subshell_redir )
+                    is_waiting_sep = 1;
+                else
+                    is_waiting_arg = 1;
+                is_free = 1;
+                // Separators and redirections right after the file name are handled in the next iteration
+                if ( !isspace(*current_char) )
+                    continue;
+            }
+            else {
+                buffer[buffer_index++] = *current_char;
+            }
+        }
         else if ( is_reading_command ) {
-            if (isspace(*current_char)) {
+            if (isspace(*current_char) || *current_char == '<' || *current_char == '>') {
                 buffer[buffer_index] = '\0';
-                write_buffer(input, buffer, 1, is_pipeline);
+                write_buffer(input, buffer, 1, is_pipeline, 0);
                 buffer_index = 0;
                 is_reading_command = 0;
                 is_waiting_arg = 1;
                 is_free = 1;
+                if ( !isspace(*current_char) )
+                    continue;
             }
             else if ( *current_char == ';' ) {
                 if ( input->separator == SEPARATOR_PARA ) {
@@ -321,7 +472,7 @@ int parse_line(char *line, parsed_input *input) {
                     is_pipeline = 1;
                 }
                 buffer[buffer_index] = '\0';
-                write_buffer(input, buffer, 1, is_pipeline);
+                write_buffer(input, buffer, 1, is_pipeline, 0);
                 buffer_index = 0;
                 input->separator = SEPARATOR_SEQ;
                 is_reading_command = 0;
@@ -345,8 +496,10 @@ int parse_line(char *line, parsed_input *input) {
                     is_pipeline = 1;
                 }
                 buffer[buffer_index] = '\0';
-                write_buffer(input, buffer, 1, is_pipeline);
+                write_buffer(input, buffer, 1, is_pipeline, 0);
                 buffer_index = 0;
+                if ( !read_distribution(input, &current_char) )
+                    return 0;
                 input->separator = SEPARATOR_PARA;
                 is_reading_command = 0;
                 is_waiting_command = 1;
@@ -357,7 +510,7 @@ int parse_line(char *line, parsed_input *input) {
             else if ( *current_char == '|' ) {
                 if (input->separator == SEPARATOR_PIPE) {
                     buffer[buffer_index] = '\0';
-                    write_buffer(input, buffer, 1, is_pipeline);
+                    write_buffer(input, buffer, 1, is_pipeline, 0);
                     buffer_index = 0;
                     is_reading_command = 0;
                     is_waiting_command = 1;
@@ -365,7 +518,7 @@ int parse_line(char *line, parsed_input *input) {
                 }
                 else if ( input->separator == SEPARATOR_PARA || input->separator == SEPARATOR_SEQ ) {
                     buffer[buffer_index] = '\0';
-                    write_buffer(input, buffer, 1, is_pipeline);
+                    write_buffer(input, buffer, 1, is_pipeline, 0);
                     buffer_index = 0;
                     int input_index = input->num_inputs-1;
                     if ( input->inputs[input_index].type == INPUT_TYPE_COMMAND ) {
@@ -380,7 +533,7 @@ int parse_line(char *line, parsed_input *input) {
                 }
                 else {
                     buffer[buffer_index] = '\0';
-                    write_buffer(input, buffer, 1, is_pipeline);
+                    write_buffer(input, buffer, 1, is_pipeline, 0);
                     buffer_index = 0;
                     input->separator = SEPARATOR_PIPE;
                     is_reading_command = 0;
@@ -393,13 +546,15 @@ int parse_line(char *line, parsed_input *input) {
             }
         }
         else if ( is_reading_arg ) {
-            if (isspace(*current_char)) {
+            if (isspace(*current_char) || *current_char == '<' || *current_char == '>') {
                 buffer[buffer_index] = '\0';
-                write_buffer(input, buffer, 0, is_pipeline);
+                write_buffer(input, buffer, 0, is_pipeline, 0);
                 buffer_index = 0;
                 is_reading_arg = 0;
                 is_waiting_arg = 1;
                 is_free = 1;
+                if ( !isspace(*current_char) )
+                    continue;
             }
             else if ( *current_char == ';' ) {
                 if ( input->separator == SEPARATOR_PARA ) {
@@ -416,7 +571,7 @@ int parse_line(char *line, parsed_input *input) {
                     is_pipeline = 1;
                 }
                 buffer[buffer_index] = '\0';
-                write_buffer(input, buffer, 0, is_pipeline);
+                write_buffer(input, buffer, 0, is_pipeline, 0);
                 buffer_index = 0;
                 input->separator = SEPARATOR_SEQ;
                 is_reading_arg = 0;
@@ -440,8 +595,10 @@ int parse_line(char *line, parsed_input *input) {
                     is_pipeline = 1;
                 }
                 buffer[buffer_index] = '\0';
-                write_buffer(input, buffer, 0, is_pipeline);
+                write_buffer(input, buffer, 0, is_pipeline, 0);
                 buffer_index = 0;
+                if ( !read_distribution(input, &current_char) )
+                    return 0;
                 input->separator = SEPARATOR_PARA;
                 is_reading_arg = 0;
                 is_waiting_command = 1;
@@ -452,7 +609,7 @@ int parse_line(char *line, parsed_input *input) {
             else if ( *current_char == '|' ) {
                 if (input->separator == SEPARATOR_PIPE) {
                     buffer[buffer_index] = '\0';
-                    write_buffer(input, buffer, 0, is_pipeline);
+                    write_buffer(input, buffer, 0, is_pipeline, 0);
                     buffer_index = 0;
                     is_reading_command = 0;
                     is_waiting_command = 1;
@@ -460,7 +617,7 @@ int parse_line(char *line, parsed_input *input) {
                 }
                 else if ( input->separator == SEPARATOR_PARA || input->separator == SEPARATOR_SEQ ) {
                     buffer[buffer_index] = '\0';
-                    write_buffer(input, buffer, 0, is_pipeline);
+                    write_buffer(input, buffer, 0, is_pipeline, 0);
                     buffer_index = 0;
                     int input_index = input->num_inputs-1;
                     if ( input->inputs[input_index].type == INPUT_TYPE_COMMAND ) {
@@ -475,7 +632,7 @@ int parse_line(char *line, parsed_input *input) {
                 }
                 else {
                     buffer[buffer_index] = '\0';
-                    write_buffer(input, buffer, 1, is_pipeline);
+                    write_buffer(input, buffer, 1, is_pipeline, 0);
                     buffer_index = 0;
                     input->separator = SEPARATOR_PIPE;
                     is_reading_arg = 0;
@@ -491,22 +648,36 @@ int parse_line(char *line, parsed_input *input) {
     }
     if ( is_reading_command ) {
         buffer[buffer_index] = '\0';
-        write_buffer(input, buffer, 1, is_pipeline);
+        write_buffer(input, buffer, 1, is_pipeline, 0);
     }
     else if ( is_reading_arg ) {
         buffer[buffer_index] = '\0';
-        write_buffer(input, buffer, 0, is_pipeline);
+        write_buffer(input, buffer, 0, is_pipeline, 0);
+    }
+    else if ( is_reading_redir ) {
+        buffer[buffer_index] = '\0';
+        write_redirection(input, buffer, redir_char, is_append, is_subshell_redir);
+    }
+    else if ( is_waiting_redir ) {
+        fprintf(stderr, "There should be a file name after redirection.\n");
+        return 0;
     }
 
     return !is_waiting_command;
 }
 
+void free_redirection(redirection *redir) {
+    free(redir->input_file);
+    free(redir->output_file);
+}
+
 void free_command(command *cmd) {
     if (cmd == NULL) return;
     // Free each argument in the command
     for (int i = 0; i < MAX_ARGS && cmd->args[i] != NULL; i++) {
         free(cmd->args[i]); // Free each argument string
     }
+    free_redirection(&cmd->redir);
     // No need to free cmd itself since it's part of an array or union
 }
 
@@ -523,7 +694,8 @@ void free_single_input(single_input *input) {
     if (input == NULL) return;
     switch (input->type) {
         case INPUT_TYPE_SUBSHELL:
-            // Since subshell uses a fixed-size char array, there's no dynamic memory to free
+            // Since subshell uses a fixed-size char array, only its redirections are freed
+            free_redirection(&input->redir);
             break;
         case INPUT_TYPE_COMMAND:
             free_command(&input->data.cmd); // Free the command structure
@@ -545,19 +717,29 @@ void free_parsed_input(parsed_input *input) {
     // Since inputs is a fixed-size array within the structure, no need to free it separately
 }
 
+void print_redirection(redirection *redir) {
+    if (redir->input_file)
+        printf("< %s ", redir->input_file);
+    if (redir->output_file)
+        printf("%s %s ", redir->output_mode == REDIRECT_APPEND ? ">>" : ">", redir->output_file);
+}
+
 void pretty_print(parsed_input *input) {
     for (int i = 0; i < input->num_inputs; i++) {
         single_input *inp = &input->inputs[i];
         printf("Input %d: ", i + 1);
         switch (inp->type) {
             case INPUT_TYPE_SUBSHELL:
-                printf("Subshell: %s\n", inp->data.subshell);
+                printf("Subshell: %s ", inp->data.subshell);
+                print_redirection(&inp->redir);
+                printf("\n");
                 break;
             case INPUT_TYPE_COMMAND:
                 printf("Command: ");
                 for (char **arg = inp->data.cmd.args; *arg != NULL; arg++) {
                     printf("%s ", *arg);
                 }
+                print_redirection(&inp->data.cmd.redir);
                 printf("\n");
                 break;
             case INPUT_TYPE_PIPELINE:
@@ -568,6 +750,7 @@ void pretty_print(parsed_input *input) {
                     for (char **arg = cmd->args; *arg != NULL; arg++) {
                         printf("%s ", *arg);
                     }
+                    print_redirection(&cmd->redir);
                     printf("\n");
                 }
                 break;
@@ -576,7 +759,10 @@ void pretty_print(parsed_input *input) {
             switch (input->separator) {
                 case SEPARATOR_PIPE: printf("Followed by: SEPARATOR_PIPE\n"); break;
                 case SEPARATOR_SEQ: printf("Followed by: SEPARATOR_SEQ\n"); break;
-                case SEPARATOR_PARA: printf("Followed by: SEPARATOR_PARA\n"); break;
+                case SEPARATOR_PARA:
+                    printf("Followed by: SEPARATOR_PARA%s\n", input->distribution == DISTRIBUTE_ROUND_ROBIN ? " (round-robin)" :
+                                                              input->distribution == DISTRIBUTE_READY ? " (ready)" : "");
+                    break;
                 default: break; // Should not happen
             }
         }
@@ -22,8 +22,24 @@ typedef enum {
     SEPARATOR_NONE, SEPARATOR_PIPE, SEPARATOR_SEQ, SEPARATOR_PARA
 } SEPARATOR;
 
+typedef enum {
+    DISTRIBUTE_DEFAULT, DISTRIBUTE_BROADCAST, DISTRIBUTE_ROUND_ROBIN, DISTRIBUTE_READY
+} DISTRIBUTION_MODE;
+
+typedef enum {
+    REDIRECT_NONE, REDIRECT_TRUNCATE, REDIRECT_APPEND
+} REDIRECT_MODE;
+
+typedef struct {
+    char *input_file;  // File given with <, NULL if none
+    char *output_file; // File given with > or >>, NULL if none
+    REDIRECT_MODE output_mode; // Whether output_file is truncated or appended
+} redirection;
+
 typedef struct {
     char *args[MAX_ARGS]; // Null-terminated arguments
+    redirection redir; // Redirections of the command
+    unsigned int quoted; // Bit i is set if args[i] was quoted, quoted args are not glob expanded
 } command;
 
 typedef struct {
@@ -40,11 +56,13 @@ typedef union {
 typedef struct {
     SINGLE_INPUT_TYPE type; // Type of the inputs
     single_input_union data; // Actual input which is union.
+    redirection redir; // Redirections of a subshell, commands keep their own
 } single_input;
 
 typedef struct {
     single_input inputs[MAX_INPUTS]; // Array of inputs
     SEPARATOR separator; // Separators for the input
+    DISTRIBUTION_MODE distribution; // How a parallel subshell shares its stdin, set by ",%" or ",?"
     int num_inputs; // Number of inputs
 } parsed_input;
 
@@ -52,6 +70,9 @@ typedef struct {
  * Parses one input line and fills the parsed_input struct given as a pointer.
  * It can handle any number of spaces between arguments and separators.
  * It has support for single or double-quoted commands and arguments.
+ * It has support for <, > and >> redirections after commands and subshells.
+ * Parallel separators can be written as ",%" to split the stdin of a parallel subshell between
+ * its branches round-robin or as ",?" to give it to whichever branch is ready first.
  * It returns 1 if it is a valid input and 0 otherwise.
  * @param line
  * @param input
@@ -0,0 +1,187 @@
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include "server.h"
+#include "cache.h"
+
+enum { PATH_CACHE_EMPTY, PATH_CACHE_WRITING, PATH_CACHE_READY };
+
+// Mapped shared before the first worker is forked, NULL outside server mode.
+path_cache_entry *path_cache = NULL;
+
+int exec_command(char **args) {
+    if (path_cache == NULL || strchr(args[0], '/') || strlen(args[0]) >= PATH_CACHE_NAME_SIZE) {
+        return execvp(args[0], args);
+    }
+    unsigned int hash = 0;
+    for (const char *c = args[0]; *c; c++) {
+        hash = hash * 31 + (unsigned char)*c;
+    }
+    for (int probe = 0; probe < PATH_CACHE_SLOTS; probe++) {
+        path_cache_entry *entry = &path_cache[(hash + probe) % PATH_CACHE_SLOTS];
+        int state = __atomic_load_n(&entry->state, __ATOMIC_ACQUIRE);
+        if (state == PATH_CACHE_READY && strcmp(entry->name, args[0]) == 0) {
+            execv(entry->path, args);
+            break; // the binary is gone, search PATH again
+        }
+        if (state == PATH_CACHE_EMPTY) {
+            char path[PATH_MAX];
+            if (!resolve_binary(args[0], path)) break;
+            if (__atomic_compare_exchange_n(&entry->state, &state, PATH_CACHE_WRITING, 0,
+                                            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                strcpy(entry->name, args[0]);
+                strcpy(entry->path, path);
+                __atomic_store_n(&entry->state, PATH_CACHE_READY, __ATOMIC_RELEASE);
+            }
+            execv(path, args);
+            break;
+        }
+        // Another name or one that is being written, try the next slot
+    }
+    return execvp(args[0], args);
+}
+
+/***
+ * Receives the command line and the client's file descriptors.
+ * Returns 1 on success and 0 if the request is malformed.
+ * @param conn
+ * @param line
+ * @param fds
+ * @return
+ */
+int receive_request(int conn, char *line, int *fds) {
+    char control[CMSG_SPACE(SERVER_NUM_FDS * sizeof(int))];
+    struct iovec iov = { line, INPUT_BUFFER_SIZE - 1 };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t nbytes = recvmsg(conn, &msg, 0);
+    if (nbytes <= 0) {
+        return 0;
+    }
+    line[nbytes] = '\0';
+    line[strcspn(line, "\n")] = '\0';
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS ||
+        cmsg->cmsg_len != CMSG_LEN(SERVER_NUM_FDS * sizeof(int))) {
+        return 0;
+    }
+    memcpy(fds, CMSG_DATA(cmsg), SERVER_NUM_FDS * sizeof(int));
+    return 1;
+}
+
+/***
+ * Serves one connection. Runs in its own process so the server can keep accepting.
+ * The line is executed in a further child whose stdio are the client's descriptors,
+ * this process waits for it to collect the exit code and resource usage for the reply.
+ * @param conn
+ * @param execute
+ */
+void serve_connection(int conn, int (*execute)(char *line)) {
+    char line[INPUT_BUFFER_SIZE];
+    int fds[SERVER_NUM_FDS];
+    server_reply reply;
+    memset(&reply, 0, sizeof(reply));
+
+    if (!receive_request(conn, line, fds)) {
+        fprintf(stderr, "Invalid request.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("fork");
+        exit(EXIT_FAILURE);
+    } else if (pid == 0) { // Child process
+        close(conn);
+        for (int i = 0; i < SERVER_NUM_FDS; i++) {
+            dup2(fds[i], i);
+            close(fds[i]);
+        }
+        signal(SIGPIPE, SIG_DFL);
+        exit(execute(line));
+    }
+
+    for (int i = 0; i < SERVER_NUM_FDS; i++) {
+        close(fds[i]);
+    }
+    int status;
+    if (wait4(pid, &status, 0, &reply.usage) == -1) {
+        perror("wait4");
+        exit(EXIT_FAILURE);
+    }
+    reply.status = WIFSIGNALED(status) ? 128 + WTERMSIG(status) : WEXITSTATUS(status);
+    write(conn, &reply, sizeof(reply));
+    close(conn);
+    exit(EXIT_SUCCESS);
+}
+
+int run_server(const char *path, int max_workers, int (*execute)(char *line)) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path is too long.\n");
+        return EXIT_FAILURE;
+    }
+    strcpy(addr.sun_path, path);
+
+    struct stat st;
+    if (lstat(path, &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            fprintf(stderr, "%s exists and is not a socket.\n", path);
+            return EXIT_FAILURE;
+        }
+        unlink(path); // left over from an earlier server
+    }
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd == -1) {
+        perror("socket");
+        return EXIT_FAILURE;
+    }
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 || listen(listen_fd, SOMAXCONN) == -1) {
+        perror(path);
+        return EXIT_FAILURE;
+    }
+    signal(SIGPIPE, SIG_IGN); // a client leaving early should not kill the server
+    path_cache = (path_cache_entry *)mmap(NULL, PATH_CACHE_SLOTS * sizeof(path_cache_entry), PROT_READ | PROT_WRITE,
+                                          MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (path_cache == MAP_FAILED) {
+        path_cache = NULL; // lines still run, only without the cache
+    }
+
+    int active_workers = 0;
+    while (1) {
+        // Reap finished workers, block only when the limit is reached
+        while (active_workers > 0 && waitpid(-1, NULL, active_workers < max_workers ? WNOHANG : 0) > 0) {
+            active_workers--;
+        }
+
+        int conn = accept(listen_fd, NULL, NULL);
+        if (conn == -1) {
+            if (errno != EINTR) perror("accept");
+            continue;
+        }
+
+        pid_t pid = fork();
+        if (pid == -1) {
+            perror("fork");
+        } else if (pid == 0) { // Child process
+            close(listen_fd);
+            serve_connection(conn, execute);
+        } else {
+            active_workers++;
+        }
+        close(conn);
+    }
+}
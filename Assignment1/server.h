@@ -0,0 +1,55 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <sys/resource.h>
+#include <limits.h>
+#include "parser.h"
+
+#define SERVER_DEFAULT_WORKERS 8
+#define SERVER_NUM_FDS 3 // stdin, stdout and stderr of the client
+#define PATH_CACHE_SLOTS 256 // Command names whose binary the server remembers
+#define PATH_CACHE_NAME_SIZE 64
+
+/***
+ * Reply sent back to the client after its command line finishes.
+ * The request itself is one message holding the command line with
+ * the client's stdin, stdout and stderr attached as SCM_RIGHTS.
+ */
+typedef struct {
+    int status; // Exit code of the command line, 128+signal if it was killed
+    struct rusage usage; // Resources used by the command line and everything it waited for
+} server_reply;
+
+/***
+ * A command name and the binary PATH resolved it to, shared by all workers of a server.
+ * The slot is claimed by moving state from empty to writing and published by setting it to ready.
+ */
+typedef struct {
+    int state;
+    char name[PATH_CACHE_NAME_SIZE];
+    char path[PATH_MAX];
+} path_cache_entry;
+
+/***
+ * Replaces the process with the command like execvp. In server mode the binary is looked up
+ * in the path cache first and the result of a PATH search is stored there for later requests.
+ * A cached binary that cannot be executed any more falls back to execvp.
+ * Like execvp it only returns on failure.
+ * @param args
+ * @return
+ */
+int exec_command(char **args);
+
+/***
+ * Listens on the unix socket at path and runs every received command line
+ * with the client's file descriptors. At most max_workers lines run at the same time.
+ * An existing socket at path is replaced, any other file is left alone and the server refuses to start.
+ * It only returns if the socket cannot be set up.
+ * @param path
+ * @param max_workers
+ * @param execute Runs one command line and returns its exit code
+ * @return
+ */
+int run_server(const char *path, int max_workers, int (*execute)(char *line));
+
+#endif //SERVER_H
@@ -4,9 +4,11 @@
 #include <stdio.h>
 
 #include <pthread.h>
-#include <sys/time.h>
+#include <time.h>
 
-#define GRADING
+#define WRITE_OUTPUT_LINE_SIZE 160 // longest possible trace line, with room to spare
+#define LOG_RING_SIZE 1024 // records buffered per thread in asynchronous mode
+#define LOG_FLUSH_SIZE (1024 * 1024) // bytes the flusher collects before a write
 
 #ifdef __cplusplus
 extern "C" {
@@ -19,10 +21,94 @@ typedef enum Action {
     FINISH_PASSING
 }Action;
 
+typedef enum OutputMode {
+    OUTPUT_GRADING, // thread id, car, connector, time stamp and action separated by spaces
+    OUTPUT_VERBOSE, // the same fields with labels and the action spelled out
+    OUTPUT_BINARY,  // fixed size TraceRecords in the file given to OpenBinaryTrace
+    OUTPUT_NONE     // lines are dropped, for benchmarks that only time the connectors
+}OutputMode;
+
+#define TRACE_MAGIC "SIMTRACE"
+#define TRACE_VERSION 2
+#define TRACE_HEADER_SIZE 4096 // records start on a page boundary
+#define TRACE_SEGMENT_RECORDS (1 << 20) // records mapped at a time, 32 MB
+#define TRACE_MAX_SEGMENTS 4096
+
+/**
+ * Start of a binary trace file, padded to TRACE_HEADER_SIZE.
+ * recordCount and ordered are filled in by CloseBinaryTrace, a trace that was not closed has
+ * 0 there and its length has to be derived from the file size.
+ */
+typedef struct TraceHeader {
+    char magic[8];
+    unsigned int version;
+    unsigned int recordSize;
+    unsigned long long recordCount;
+    unsigned int narrowBridges;
+    unsigned int ferries;
+    unsigned int crossroads;
+    unsigned int cars;
+    unsigned int ordered; // 1 if no record has an earlier time than a record before it
+}TraceHeader;
+
+/**
+ * One WriteOutput call. Records are stored in the order the calls reserved their slots. The
+ * threaded engine reads the clock with the slot, engines that pass their own time stamps to
+ * WriteOutputAt may store a record after a later one, see TraceHeader.ordered.
+ */
+typedef struct TraceRecord {
+    unsigned long long threadID;
+    unsigned long long time; // nanoseconds
+    int carID;
+    int connectorID;
+    char connectorType;
+    char action;
+    char padding[6];
+}TraceRecord;
+
+typedef enum ClockSource {
+    CLOCK_SOURCE_MONOTONIC, // clock_gettime(CLOCK_MONOTONIC)
+    CLOCK_SOURCE_TSC        // the time stamp counter, calibrated against CLOCK_MONOTONIC at init
+}ClockSource;
+
+#define TSC_CALIBRATION_NS 20000000 // how long InitWriteOutput measures the TSC rate
+
+/**
+ * Selects the clock read by GetTimestamp. Must be called before InitWriteOutput.
+ * Returns -1 and keeps CLOCK_MONOTONIC if the CPU has no invariant TSC.
+ */
+int SetClockSource(ClockSource source);
+
+/**
+ * Sets how many nanoseconds one printed time stamp unit is, 1000000 (milliseconds) by default.
+ * Time stamps are kept in nanoseconds everywhere else.
+ */
+void SetTimestampUnit(unsigned long long nanoseconds);
+
 void InitWriteOutput();
-unsigned long long GetTimestamp();
+unsigned long long GetTimestampNs(); // since InitWriteOutput
+unsigned long long GetTimestamp(); // the same in printed units
 void PrintThreadId(FILE *f);
 
+void SetOutputMode(OutputMode mode);
+OutputMode GetOutputMode();
+
+/**
+ * Renders a text line in the current mode (grading or verbose) into buf,
+ * which must hold WRITE_OUTPUT_LINE_SIZE bytes. Returns the line length.
+ * time is in nanoseconds and printed in the unit given to SetTimestampUnit.
+ */
+int FormatOutputLine(char *buf, const unsigned char *tid, size_t tid_size, unsigned long long time,
+                     int carID, char connector_type, int connectorID, Action action);
+
+/**
+ * Creates path and switches to OUTPUT_BINARY. The counts describe the scenario in the header.
+ * Returns 0 on success, -1 with errno set otherwise.
+ * CloseBinaryTrace records the final length and must be called once all writers are done.
+ */
+int OpenBinaryTrace(const char *path, int narrowBridges, int ferries, int crossroads, int cars);
+void CloseBinaryTrace();
+
 /**
  *
  * @param carID
@@ -32,6 +118,23 @@ void PrintThreadId(FILE *f);
  */
 //void WriteOutputf(FILE *f, int carID, char connector_type, int connectorID, Action action);
 void WriteOutput(int carID, char connector_type, int connectorID, Action action);
+
+/**
+ * Same line as WriteOutput, but with the thread id and time stamp (in nanoseconds) given by the caller.
+ * Used by engines that do not run each car on its own thread or in real time.
+ */
+void WriteOutputAt(unsigned long long threadID, unsigned long long time,
+                   int carID, char connector_type, int connectorID, Action action);
+
+/**
+ * Switches WriteOutput to per-thread buffers merged by a background flusher.
+ * The text is the same, writers no longer take the output lock or call stdio. Lines come out
+ * in time stamp order, a writer whose buffer is full sleeps until the flusher has made room.
+ * WriteOutputAt time stamps have to be non-decreasing for each thread.
+ * StopAsyncWriteOutput writes out everything that is buffered and must be called before exit.
+ */
+void StartAsyncWriteOutput();
+void StopAsyncWriteOutput();
 #ifdef __cplusplus
 }
 #endif
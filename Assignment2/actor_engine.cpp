@@ -0,0 +1,318 @@
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <queue>
+#include <thread>
+#include <vector>
+#include <linux/futex.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include "actor_engine.h"
+#include "WriteOutput.h"
+#include "helper.h"
+#include "connector_rules.h"
+
+namespace {
+
+typedef unsigned long long Nanoseconds; // GetTimestampNs time
+
+const Nanoseconds MS = 1000000ULL;
+
+enum TimerKind {
+    CAR_ARRIVE,     // the car reached the connector of its current segment
+    CAR_FINISH,     // the car left the connector
+    CONNECTOR_WAKE  // a pass delay or a timeout of the connector is over
+};
+
+struct Timer {
+    Nanoseconds time;
+    unsigned long long seq; // keeps timers of the same time in scheduling order
+    TimerKind kind;
+    int car;
+    int connector; // index into the worker's connectors
+
+    bool operator>(const Timer &other) const {
+        return time != other.time ? time > other.time : seq > other.seq;
+    }
+};
+
+//! A car in transit is the message itself, so handing it over allocates nothing.
+struct CarNode {
+    std::atomic<CarNode*> next;
+    int car;
+};
+
+//! Intrusive multi producer, single consumer queue (Vyukov). Push is one exchange and never
+//! waits, Pop may miss a car whose push is half done, the producer wakes the worker after
+//! it completes, so the car is seen on the next round.
+class Inbox {
+    std::atomic<CarNode*> head; // Producers
+    alignas(64) CarNode *tail; // Consumer
+    CarNode stub;
+
+public:
+    Inbox() : head(&stub), tail(&stub) { stub.next.store(nullptr, std::memory_order_relaxed); }
+
+    void Push(CarNode *node) {
+        node->next.store(nullptr, std::memory_order_relaxed);
+        CarNode *previous = head.exchange(node, std::memory_order_acq_rel);
+        previous->next.store(node, std::memory_order_release);
+    }
+
+    CarNode *Pop() {
+        CarNode *first = tail, *next = first->next.load(std::memory_order_acquire);
+        if (first == &stub) {
+            if (next == nullptr) return nullptr;
+            tail = first = next;
+            next = next->next.load(std::memory_order_acquire);
+        }
+        if (next != nullptr) {
+            tail = next;
+            return first;
+        }
+        if (first != head.load(std::memory_order_acquire)) return nullptr; // A push is in progress
+        Push(&stub);
+        next = first->next.load(std::memory_order_acquire);
+        if (next == nullptr) return nullptr;
+        tail = next;
+        return first;
+    }
+};
+
+class Worker;
+
+//! A connector of a worker, bridges and crossroads are crossings
+struct Owned {
+    char type;
+    int id;
+    std::unique_ptr<CrossingRules<Worker> > crossing;
+    std::unique_ptr<FerryRules<Worker> > ferry;
+};
+
+//! What the workers share. Cars and their segment indices are only touched by the worker
+//! that holds the car, the queues order the hand over.
+struct Engine {
+    const Scenario &scenario;
+    std::vector<std::unique_ptr<Worker> > workers;
+    std::vector<int> owner[3]; // worker of every N, F and C
+    std::vector<int> localIndex[3]; // index of the connector in its worker
+    std::vector<CarNode> cars;
+    std::vector<size_t> segmentIndex;
+    std::atomic<long> remaining; // cars that have not finished their path
+
+    explicit Engine(const Scenario &s) : scenario(s), cars(s.cars.size()), segmentIndex(s.cars.size(), 0),
+                                         remaining(0) {}
+
+    static int TypeIndex(char type) { return type == 'N' ? 0 : type == 'F' ? 1 : 2; }
+
+    void Send(int car);
+    void StopAll();
+};
+
+class Worker {
+    enum { AWAKE, SLEEPING };
+
+    Engine &engine;
+    Inbox inbox;
+    alignas(64) int state; // futex word, SLEEPING while the worker waits for cars or timers
+    std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer> > timers;
+    unsigned long long nextSeq;
+    unsigned long long threadID; // Written into the trace lines of the connectors
+    Nanoseconds now; // Of the timer that is being handled, connector lines carry it
+
+public:
+    typedef Nanoseconds Time;
+    typedef int Car;
+
+    std::vector<Owned> connectors;
+
+    explicit Worker(Engine &e) : engine(e), state(AWAKE), nextSeq(0), threadID(0), now(0) {}
+
+    // Called by any thread, the car travels to the connector of its current segment
+    void Deliver(CarNode *node) {
+        inbox.Push(node);
+        Wake();
+    }
+
+    void Wake() {
+        if (__atomic_exchange_n(&state, AWAKE, __ATOMIC_SEQ_CST) == SLEEPING) {
+            syscall(SYS_futex, &state, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+        }
+    }
+
+    void Schedule(Nanoseconds time, TimerKind kind, int car, int connector = -1) {
+        timers.push(Timer{ time, nextSeq++, kind, car, connector });
+    }
+
+    // The host interface of the connector rules
+    static Nanoseconds Millis(int milliseconds) { return milliseconds * MS; }
+
+    Nanoseconds Now() const { return now; }
+
+    void WakeAt(const ConnectorKey &key, Nanoseconds time) {
+        Schedule(time, CONNECTOR_WAKE, -1, key.slot);
+    }
+
+    // Every car of a ferry load starts with the same time stamp
+    void StartPassing(int carID, const ConnectorKey &key, int travelTime) {
+        WriteOutputAt(threadID, now, carID, key.type, key.id, START_PASSING);
+        Schedule(now + travelTime * MS, CAR_FINISH, carID, key.slot);
+    }
+
+    void CountSwitch() {}
+    void CountDeparture(int, int) {}
+
+    void Run() {
+        threadID = (unsigned long long)pthread_self();
+        while (engine.remaining.load(std::memory_order_acquire) > 0) {
+            for (CarNode *node; (node = inbox.Pop()) != nullptr;) Travel(node->car);
+            Nanoseconds due = GetTimestampNs();
+            while (!timers.empty() && timers.top().time <= due) {
+                Timer timer = timers.top();
+                timers.pop();
+                Fire(timer);
+            }
+            Sleep();
+        }
+    }
+
+private:
+    const PathSegment &Segment(int car) const {
+        return engine.scenario.Path(engine.scenario.cars[car])[engine.segmentIndex[car]];
+    }
+
+    void Travel(int car) {
+        const PathSegment &segment = Segment(car);
+        WriteOutput(car, segment.type, segment.id, TRAVEL);
+        Schedule(GetTimestampNs() + engine.scenario.cars[car].travelTime * MS, CAR_ARRIVE, car);
+    }
+
+    // The clock is read once per timer, every line it leads to carries that time, so what the
+    // rules count from (arrival, start, PASS_DELAY) is exactly what the trace shows
+    void Fire(const Timer &timer) {
+        now = GetTimestampNs();
+        if (timer.kind == CAR_ARRIVE) {
+            const PathSegment &segment = Segment(timer.car);
+            Owned &connector = connectors[engine.localIndex[Engine::TypeIndex(segment.type)][segment.id]];
+            WriteOutputAt(threadID, now, timer.car, segment.type, segment.id, ARRIVE);
+            if (segment.type == 'F') connector.ferry->Arrive(*this, timer.car, segment.from);
+            else connector.crossing->Arrive(*this, timer.car, segment.type == 'N' ? segment.to : segment.from);
+        } else if (timer.kind == CAR_FINISH) {
+            Owned &connector = connectors[timer.connector];
+            WriteOutputAt(threadID, now, timer.car, connector.type, connector.id, FINISH_PASSING);
+            if (connector.crossing) connector.crossing->Finish(*this);
+            engine.segmentIndex[timer.car]++;
+            engine.Send(timer.car);
+        } else {
+            Owned &connector = connectors[timer.connector];
+            if (connector.crossing) connector.crossing->Wake(*this);
+            else connector.ferry->Wake(*this);
+        }
+    }
+
+    // Waits for the next timer or a car, whichever comes first
+    void Sleep() {
+        __atomic_store_n(&state, SLEEPING, __ATOMIC_SEQ_CST);
+        if (engine.remaining.load(std::memory_order_acquire) == 0) return;
+        // A car pushed before the store is found now, one pushed after it wakes the futex
+        CarNode *node = inbox.Pop();
+        if (node != nullptr) {
+            __atomic_store_n(&state, AWAKE, __ATOMIC_RELAXED);
+            Travel(node->car);
+            return;
+        }
+        struct timespec timeout, *wait = nullptr;
+        if (!timers.empty()) {
+            Nanoseconds current = GetTimestampNs();
+            if (timers.top().time <= current) {
+                __atomic_store_n(&state, AWAKE, __ATOMIC_RELAXED);
+                return;
+            }
+            Nanoseconds left = timers.top().time - current;
+            timeout.tv_sec = left / 1000000000ULL;
+            timeout.tv_nsec = left % 1000000000ULL;
+            wait = &timeout;
+        }
+        syscall(SYS_futex, &state, FUTEX_WAIT_PRIVATE, SLEEPING, wait, NULL, 0);
+        __atomic_store_n(&state, AWAKE, __ATOMIC_RELAXED);
+    }
+};
+
+// The car is done with a segment, or has not started, and goes to the next connector
+void Engine::Send(int car) {
+    const CarSpec &spec = scenario.cars[car];
+    if (segmentIndex[car] == (size_t)spec.pathLength) {
+        if (remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) StopAll();
+        return;
+    }
+    const PathSegment &segment = scenario.Path(spec)[segmentIndex[car]];
+    workers[owner[TypeIndex(segment.type)][segment.id]]->Deliver(&cars[car]);
+}
+
+void Engine::StopAll() {
+    for (auto &worker : workers) worker->Wake();
+}
+
+// Spreads the connectors over the workers so every worker gets about as many car visits,
+// the busiest connectors first
+void Partition(Engine &engine, int numWorkers) {
+    const Scenario &scenario = engine.scenario;
+    const std::vector<ConnectorSpec> *specs[3] = { &scenario.narrowBridges, &scenario.ferries, &scenario.crossroads };
+    std::vector<unsigned long long> visits[3];
+    for (int t = 0; t < 3; ++t) {
+        visits[t].assign(specs[t]->size(), 0);
+        engine.owner[t].assign(specs[t]->size(), 0);
+        engine.localIndex[t].assign(specs[t]->size(), 0);
+    }
+    for (const PathSegment &segment : scenario.segments) visits[Engine::TypeIndex(segment.type)][segment.id]++;
+
+    std::vector<std::pair<unsigned long long, std::pair<int, int> > > order;
+    for (int t = 0; t < 3; ++t) {
+        for (size_t i = 0; i < specs[t]->size(); ++i) order.push_back({ visits[t][i], { t, (int)i } });
+    }
+    std::stable_sort(order.begin(), order.end(), [](const auto &a, const auto &b) { return a.first > b.first; });
+    std::vector<unsigned long long> load(numWorkers, 0);
+    static const char types[] = { 'N', 'F', 'C' };
+    for (const auto &[count, connector] : order) {
+        int w = std::min_element(load.begin(), load.end()) - load.begin();
+        auto [t, id] = connector;
+        Worker &worker = *engine.workers[w];
+        int index = worker.connectors.size();
+        engine.owner[t][id] = w;
+        engine.localIndex[t][id] = index;
+        load[w] += count;
+
+        Owned owned;
+        owned.type = types[t];
+        owned.id = id;
+        ConnectorKey key = { types[t], id, index };
+        if (t == 1) owned.ferry.reset(new FerryRules<Worker>(key, (*specs[t])[id]));
+        else owned.crossing.reset(new CrossingRules<Worker>(key, (*specs[t])[id], t == 0 ? 2 : 4));
+        worker.connectors.push_back(std::move(owned));
+    }
+}
+
+} // namespace
+
+void RunActors(const Scenario &scenario, int numWorkers) {
+    if (numWorkers <= 0) numWorkers = std::max(1u, std::thread::hardware_concurrency());
+
+    Engine engine(scenario);
+    for (int i = 0; i < numWorkers; ++i) engine.workers.emplace_back(new Worker(engine));
+    Partition(engine, numWorkers);
+    for (size_t i = 0; i < scenario.cars.size(); ++i) {
+        engine.cars[i].car = i;
+        if (scenario.cars[i].pathLength > 0) engine.remaining++;
+    }
+    if (engine.remaining == 0) return;
+
+    InitWriteOutput();
+    std::vector<std::thread> threads;
+    for (auto &worker : engine.workers) threads.emplace_back(&Worker::Run, worker.get());
+    for (size_t i = 0; i < scenario.cars.size(); ++i) {
+        if (scenario.cars[i].pathLength > 0) engine.Send(i);
+    }
+    for (auto &thread : threads) thread.join();
+}
@@ -0,0 +1,13 @@
+#ifndef HOMEWORK2_ACTOR_ENGINE_H
+#define HOMEWORK2_ACTOR_ENGINE_H
+
+#include "scenario.h"
+
+// Runs the scenario in real time with the connectors partitioned over numWorkers threads
+// (the core count if 0). Every worker owns the state of its connectors, nothing is locked, and
+// runs them with the rules in connector_rules.h.
+// A car belongs to the worker of the connector it travels to and is handed to the next
+// worker through that worker's lock free queue.
+void RunActors(const Scenario &scenario, int numWorkers = 0);
+
+#endif //HOMEWORK2_ACTOR_ENGINE_H
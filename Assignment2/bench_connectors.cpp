@@ -0,0 +1,78 @@
+// Measures how fast threads get through connectors that sit next to each other in memory.
+// Usage: bench_connectors [seconds] [threads...]
+// Thread i keeps passing narrow bridge i, ferry i and crossroad i with zero travel time,
+// so no two threads ever touch the same connector and every slowdown with more threads
+// comes from the memory layout. Build bench_connectors_packed to compare with connectors
+// packed back to back. The trace is dropped.
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+#include "connectors.h"
+
+struct Connectors {
+    ConnectorArena<NarrowBridge> narrowBridges;
+    ConnectorArena<Ferry> ferries;
+    ConnectorArena<Crossroad> crossroads;
+
+    explicit Connectors(int n) {
+        narrowBridges.Reserve(n);
+        ferries.Reserve(n);
+        crossroads.Reserve(n);
+        for (int i = 0; i < n; ++i) {
+            narrowBridges.Emplace(i, 0, 1000);
+            ferries.Emplace(i, 0, 1000, 1); // a ferry of capacity one leaves right away
+            crossroads.Emplace(i, 0, 1000);
+        }
+    }
+};
+
+static double Run(int numThreads, double seconds) {
+    Connectors connectors(numThreads);
+    std::atomic<bool> stop(false);
+    std::vector<long> passes(numThreads);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < numThreads; ++i) {
+        threads.emplace_back([&, i] {
+            long count = 0;
+            while (!stop.load(std::memory_order_relaxed)) {
+                connectors.narrowBridges[i].Pass(i, 0);
+                connectors.ferries[i].Pass(i, 0);
+                connectors.crossroads[i].Pass(i, 0);
+                count += 3;
+            }
+            passes[i] = count;
+        });
+    }
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+    stop = true;
+    long total = 0;
+    for (int i = 0; i < numThreads; ++i) {
+        threads[i].join();
+        total += passes[i];
+    }
+    return total / seconds;
+}
+
+int main(int argc, char *argv[]) {
+    double seconds = argc > 1 ? atof(argv[1]) : 1.0;
+    std::vector<int> threadCounts;
+    for (int i = 2; i < argc; ++i) threadCounts.push_back(atoi(argv[i]));
+    if (threadCounts.empty()) {
+        int cores = std::thread::hardware_concurrency();
+        for (int n = 1; n <= cores; n *= 2) threadCounts.push_back(n);
+    }
+
+    SetOutputMode(OUTPUT_NONE);
+    InitWriteOutput();
+    printf("alignment %d, %zu bytes per narrow bridge, %zu per ferry, %zu per crossroad\n",
+           CONNECTOR_ALIGNMENT, sizeof(NarrowBridge), sizeof(Ferry), sizeof(Crossroad));
+    printf("%8s %14s %18s\n", "threads", "passes/s", "passes/s/thread");
+    for (int numThreads : threadCounts) {
+        double rate = Run(numThreads, seconds);
+        printf("%8d %14.0f %18.0f\n", numThreads, rate, rate / numThreads);
+    }
+    return 0;
+}
@@ -0,0 +1,42 @@
+// Measures how the coroutine engine scales with the number of cars.
+// Usage: bench_coroutines [workers] [cars...]
+// Every car crosses three of 64 ferries, so the run time is dominated by
+// scheduling rather than by waiting in line. The trace goes to /dev/null.
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <sys/resource.h>
+#include "coroutine_engine.h"
+
+int main(int argc, char *argv[]) {
+    int numWorkers = argc > 1 ? atoi(argv[1]) : 0;
+    std::vector<long> carCounts;
+    for (int i = 2; i < argc; ++i) carCounts.push_back(atol(argv[i]));
+    if (carCounts.empty()) carCounts = { 1000, 10000, 100000, 1000000 };
+
+    if (freopen("/dev/null", "w", stdout) == NULL) return 1;
+    fprintf(stderr, "%10s %10s %12s %12s %12s\n", "cars", "wall ms", "cars/s", "events/s", "max rss MB");
+    for (long numCars : carCounts) {
+        Scenario scenario;
+        const int numFerries = 64;
+        for (int i = 0; i < numFerries; ++i) scenario.ferries.emplace_back(10, 20, 1000);
+        scenario.cars.resize(numCars);
+        for (long i = 0; i < numCars; ++i) {
+            scenario.cars[i].travelTime = 10 + i % 7;
+            scenario.cars[i].firstSegment = scenario.segments.size();
+            scenario.cars[i].pathLength = 3;
+            for (int j = 0; j < 3; ++j) scenario.segments.emplace_back('F', (i * 7 + j * 13) % numFerries, j % 2, 1 - j % 2);
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        RunCoroutines(scenario, numWorkers);
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        long events = numCars * 3 * 4; // travel, arrive, start and finish per segment
+        fprintf(stderr, "%10ld %10.0f %12.0f %12.0f %12.1f\n", numCars, ms, numCars / ms * 1000,
+                events / ms * 1000, usage.ru_maxrss / 1024.0);
+    }
+    return 0;
+}
@@ -0,0 +1,164 @@
+// Compares the pthread Monitor with the futex one (bench_monitor_futex is the same code
+// built with -DMONITOR_FUTEX).
+// Usage: bench_monitor [seconds] [threads]
+//   lock:      threads bump a counter in a tiny critical section
+//   handoff:   two threads take turns through a Condition
+//   broadcast: one thread wakes the others with notifyAll and waits for all of them
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+#include <sys/resource.h>
+#include "monitor.h"
+
+#ifdef MONITOR_FUTEX
+#define MONITOR_NAME "futex"
+#else
+#define MONITOR_NAME "pthread"
+#endif
+
+class Counter : public Monitor {
+    long value;
+public:
+    Counter() : value(0) {}
+    void Add() {
+        __synchronized__;
+        value++;
+    }
+};
+
+class Turns : public Monitor {
+    int turn;
+    bool done;
+    Condition changed;
+public:
+    Turns() : turn(0), done(false), changed(this) {}
+    // last is passed on the final turn, the other side sees it on its very next Take
+    bool Take(int me, bool last = false) {
+        __synchronized__;
+        while (turn != me) changed.wait();
+        if (last) done = true;
+        turn = 1 - me;
+        changed.notify();
+        return done;
+    }
+};
+
+class Rounds : public Monitor {
+    long round;
+    int arrived;
+    int parties;
+    Condition started, finished;
+public:
+    explicit Rounds(int n) : round(0), arrived(n), parties(n), started(this), finished(this) {}
+    void Start() {
+        __synchronized__;
+        while (arrived < parties) finished.wait();
+        arrived = 0;
+        round++;
+        started.notifyAll();
+    }
+    bool Join(long &seen) {
+        __synchronized__;
+        while (round == seen) started.wait();
+        seen = round;
+        if (++arrived == parties) finished.notify();
+        return round >= 0;
+    }
+    void Stop() {
+        __synchronized__;
+        round = -1;
+        started.notifyAll();
+    }
+};
+
+typedef std::chrono::steady_clock Clock;
+
+static long ContextSwitches() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_nvcsw + usage.ru_nivcsw;
+}
+
+static void Report(const char *name, long operations, double seconds, long switches) {
+    printf("%-8s %-10s %14.0f %18.3f\n", MONITOR_NAME, name, operations / seconds, (double)switches / operations);
+}
+
+static void BenchLock(int numThreads, double seconds) {
+    Counter counter;
+    std::atomic<bool> stop(false);
+    std::atomic<long> total(0);
+    long switches = ContextSwitches();
+    std::vector<std::thread> threads;
+    for (int i = 0; i < numThreads; ++i) {
+        threads.emplace_back([&] {
+            long count = 0;
+            while (!stop.load(std::memory_order_relaxed)) {
+                counter.Add();
+                count++;
+            }
+            total += count;
+        });
+    }
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+    stop = true;
+    for (auto& thread : threads) thread.join();
+    Report("lock", total, seconds, ContextSwitches() - switches);
+}
+
+static void BenchHandoff(double seconds) {
+    Turns turns;
+    long rounds = 0;
+    long switches = ContextSwitches();
+    auto end = Clock::now() + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds));
+    std::thread other([&] {
+        while (!turns.Take(1)) {}
+    });
+    auto start = Clock::now();
+    while (true) {
+        rounds++;
+        bool last = rounds % 1024 == 0 && Clock::now() >= end;
+        turns.Take(0, last);
+        if (last) break;
+    }
+    other.join();
+    double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    Report("handoff", rounds, elapsed, ContextSwitches() - switches);
+}
+
+static void BenchBroadcast(int numThreads, double seconds) {
+    Rounds rounds(numThreads);
+    std::vector<std::thread> threads;
+    long switches = ContextSwitches();
+    for (int i = 0; i < numThreads; ++i) {
+        threads.emplace_back([&] {
+            long seen = 0;
+            while (rounds.Join(seen)) {}
+        });
+    }
+    long count = 0;
+    auto start = Clock::now();
+    auto end = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds));
+    while (Clock::now() < end) {
+        rounds.Start();
+        count++;
+    }
+    rounds.Stop();
+    for (auto& thread : threads) thread.join();
+    double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    Report("broadcast", count, elapsed, ContextSwitches() - switches);
+}
+
+int main(int argc, char *argv[]) {
+    double seconds = argc > 1 ? atof(argv[1]) : 1.0;
+    int numThreads = argc > 2 ? atoi(argv[2]) : std::thread::hardware_concurrency();
+    if (numThreads < 2) numThreads = 2;
+
+    printf("%-8s %-10s %14s %18s\n", "monitor", "test", "operations/s", "switches/operation");
+    BenchLock(numThreads, seconds);
+    BenchHandoff(seconds);
+    BenchBroadcast(numThreads, seconds);
+    return 0;
+}
@@ -0,0 +1,216 @@
+// Runs the simulator on scenarios and reports every run as a JSON object.
+// Usage: bench_scale [--simulator PATH] [--generator PATH] [--runs N] [scenario...] [-- simulator flags]
+// Without scenario files it generates a scaling suite with scenario_gen: 100, 1000 and
+// 10000 cars on 16 connectors of each type, spread evenly and with a hot spot.
+// Each run is a separate simulator process with its stdin on the scenario and a binary
+// trace. Context switches and peak RSS come from wait4, per-car latency (first TRAVEL to
+// last FINISH_PASSING) from the trace.
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "WriteOutput.h"
+
+struct RunResult {
+    double wallSeconds;
+    unsigned long long events;
+    unsigned int cars;
+    std::vector<double> latencies; // ms, one per car with a path
+    long voluntarySwitches;
+    long involuntarySwitches;
+    long peakRssKB;
+};
+
+// Runs program with stdin and stdout redirected, fills usage, returns false if it failed
+static bool RunProcess(const std::vector<std::string> &args, const char *input, const char *output, struct rusage &usage) {
+    pid_t pid = fork();
+    if (pid < 0) return false;
+    if (pid == 0) {
+        int in = open(input, O_RDONLY);
+        int out = open(output, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (in < 0 || out < 0) _exit(127);
+        dup2(in, STDIN_FILENO);
+        dup2(out, STDOUT_FILENO);
+        close(in);
+        close(out);
+        std::vector<char*> argv;
+        for (const std::string &arg : args) argv.push_back(const_cast<char*>(arg.c_str()));
+        argv.push_back(nullptr);
+        execv(argv[0], argv.data());
+        perror(argv[0]);
+        _exit(127);
+    }
+    int status;
+    if (wait4(pid, &status, 0, &usage) < 0) return false;
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static bool ReadTrace(const char *path, RunResult &result) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    void *data = fstat(fd, &st) == 0 && st.st_size >= TRACE_HEADER_SIZE
+                 ? mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (data == MAP_FAILED) return false;
+
+    const TraceHeader *header = (const TraceHeader*)data;
+    bool ok = memcmp(header->magic, TRACE_MAGIC, sizeof(header->magic)) == 0 && header->version == TRACE_VERSION &&
+              header->recordSize == sizeof(TraceRecord) &&
+              TRACE_HEADER_SIZE + header->recordCount * sizeof(TraceRecord) <= (unsigned long long)st.st_size;
+    if (ok) {
+        result.events = header->recordCount;
+        result.cars = header->cars;
+        std::vector<unsigned long long> start(header->cars, ~0ULL), end(header->cars, 0);
+        const TraceRecord *records = (const TraceRecord*)((const char*)data + TRACE_HEADER_SIZE);
+        for (unsigned long long i = 0; i < header->recordCount; ++i) {
+            const TraceRecord &record = records[i];
+            if (record.carID < 0 || (unsigned int)record.carID >= header->cars) continue;
+            if (record.action == TRAVEL) start[record.carID] = std::min(start[record.carID], record.time);
+            if (record.action == FINISH_PASSING) end[record.carID] = std::max(end[record.carID], record.time);
+        }
+        for (unsigned int car = 0; car < header->cars; ++car) {
+            if (start[car] != ~0ULL && end[car] >= start[car]) {
+                result.latencies.push_back((end[car] - start[car]) / 1e6);
+            }
+        }
+    }
+    munmap(data, st.st_size);
+    return ok;
+}
+
+static double Percentile(std::vector<double> &values, double p) {
+    if (values.empty()) return 0;
+    size_t k = std::min(values.size() - 1, (size_t)(p / 100 * values.size()));
+    std::nth_element(values.begin(), values.begin() + k, values.end());
+    return values[k];
+}
+
+static std::string JsonString(const std::string &text) {
+    std::string out = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') out += '\\';
+        out += c;
+    }
+    return out + "\"";
+}
+
+static void PrintResult(const std::string &scenario, const std::string &flags, int run, RunResult &result, bool first) {
+    printf("%s  {\"scenario\": %s, \"flags\": %s, \"run\": %d, \"cars\": %u, \"events\": %llu,"
+           " \"wall_seconds\": %.3f, \"events_per_second\": %.0f,"
+           " \"latency_ms\": {\"p50\": %.1f, \"p90\": %.1f, \"p99\": %.1f, \"max\": %.1f},"
+           " \"voluntary_switches\": %ld, \"involuntary_switches\": %ld, \"peak_rss_kb\": %ld}",
+           first ? "" : ",\n", JsonString(scenario).c_str(), JsonString(flags).c_str(), run, result.cars, result.events,
+           result.wallSeconds, result.events / result.wallSeconds,
+           Percentile(result.latencies, 50), Percentile(result.latencies, 90), Percentile(result.latencies, 99),
+           Percentile(result.latencies, 100), result.voluntarySwitches, result.involuntarySwitches, result.peakRssKB);
+    fflush(stdout);
+}
+
+// Writes the default suite to temporary files, returns their names
+static std::vector<std::string> GenerateSuite(const std::string &generator) {
+    std::vector<std::string> files;
+    const char *carCounts[] = { "100", "1000", "10000" };
+    const char *hotspots[] = { "0", "1.2" };
+    for (const char *cars : carCounts) {
+        for (const char *hotspot : hotspots) {
+            char path[] = "/tmp/bench_scale_XXXXXX";
+            int fd = mkstemp(path);
+            if (fd < 0) continue;
+            close(fd);
+            std::vector<std::string> args = { generator, "--cars", cars, "--hotspot", hotspot,
+                                              "--bridges", "16", "--ferries", "16", "--crossroads", "16",
+                                              "--path-length", "1-5", "--travel", "5-20", "--car-travel", "5-50",
+                                              "--max-wait", "20-100" };
+            struct rusage usage;
+            if (!RunProcess(args, "/dev/null", path, usage)) {
+                fprintf(stderr, "%s failed\n", generator.c_str());
+                unlink(path);
+                continue;
+            }
+            fprintf(stderr, "generated %s: %s cars, hotspot %s\n", path, cars, hotspot);
+            files.push_back(path);
+        }
+    }
+    return files;
+}
+
+int main(int argc, char *argv[]) {
+    std::string simulator = "./simulator", generator = "./scenario_gen", flags;
+    std::vector<std::string> scenarios, simulatorFlags;
+    int runs = 1;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--simulator") == 0 && i + 1 < argc) {
+            simulator = argv[++i];
+        } else if (strcmp(argv[i], "--generator") == 0 && i + 1 < argc) {
+            generator = argv[++i];
+        } else if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc) {
+            runs = std::max(1, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--") == 0) {
+            for (++i; i < argc; ++i) {
+                simulatorFlags.push_back(argv[i]);
+                flags += (flags.empty() ? "" : " ") + std::string(argv[i]);
+            }
+        } else if (argv[i][0] == '-') {
+            fprintf(stderr, "Usage: %s [--simulator PATH] [--generator PATH] [--runs N] [scenario...]"
+                            " [-- simulator flags]\n", argv[0]);
+            return 1;
+        } else {
+            scenarios.push_back(argv[i]);
+        }
+    }
+    bool generated = scenarios.empty();
+    if (generated) scenarios = GenerateSuite(generator);
+
+    char tracePath[] = "/tmp/bench_scale_trace_XXXXXX";
+    int fd = mkstemp(tracePath);
+    if (fd < 0) {
+        perror("mkstemp");
+        return 1;
+    }
+    close(fd);
+
+    int failures = 0;
+    bool first = true;
+    printf("[\n");
+    for (const std::string &scenario : scenarios) {
+        for (int run = 0; run < runs; ++run) {
+            std::vector<std::string> args = { simulator };
+            args.insert(args.end(), simulatorFlags.begin(), simulatorFlags.end());
+            args.push_back("--binary-trace");
+            args.push_back(tracePath);
+
+            RunResult result = {};
+            struct rusage usage;
+            auto start = std::chrono::steady_clock::now();
+            bool ok = RunProcess(args, scenario.c_str(), "/dev/null", usage);
+            result.wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            if (!ok || !ReadTrace(tracePath, result)) {
+                fprintf(stderr, "%s: simulator run failed\n", scenario.c_str());
+                failures++;
+                continue;
+            }
+            result.voluntarySwitches = usage.ru_nvcsw;
+            result.involuntarySwitches = usage.ru_nivcsw;
+            result.peakRssKB = usage.ru_maxrss;
+            PrintResult(scenario, flags, run, result, first);
+            first = false;
+        }
+    }
+    printf("\n]\n");
+
+    unlink(tracePath);
+    if (generated) {
+        for (const std::string &scenario : scenarios) unlink(scenario.c_str());
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,124 @@
+// Measures how long loading a large scenario takes.
+// Usage: bench_scenario [segments] [threads]
+// Writes a scenario with the given number of path segments (10 per car) to a temporary
+// file, then reads it with the old std::cin style parser and with LoadScenario on one
+// thread and on several, and checks that they all read the same paths.
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <fcntl.h>
+#include <unistd.h>
+#include "scenario.h"
+
+// The parser main() used before LoadScenario on std::cin, one vector per car and a string per segment
+struct LegacyCar {
+    int travelTime;
+    std::vector<PathSegment> path;
+};
+
+static bool LegacyReadScenario(std::istream &in, std::vector<LegacyCar> &cars) {
+    int NN, NF, NC, N;
+    if (!(in >> NN)) return false;
+    for (int i = 0; i < NN; ++i) { int t, w; in >> t >> w; }
+    if (!(in >> NF)) return false;
+    for (int i = 0; i < NF; ++i) { int t, w, c; in >> t >> w >> c; }
+    if (!(in >> NC)) return false;
+    for (int i = 0; i < NC; ++i) { int t, w; in >> t >> w; }
+    if (!(in >> N)) return false;
+    cars.resize(N);
+    for (int i = 0; i < N; ++i) {
+        int pathLength;
+        in >> cars[i].travelTime >> pathLength;
+        std::string typeID;
+        int from, to;
+        for (int j = 0; j < pathLength; j++) {
+            in >> typeID >> from >> to;
+            cars[i].path.emplace_back(typeID[0], std::stoi(typeID.substr(1)), from, to);
+        }
+    }
+    return !in.fail();
+}
+
+static void WriteScenario(const char *path, long numSegments) {
+    const int numConnectors = 1000, pathLength = 10;
+    FILE *file = fopen(path, "w");
+    fprintf(file, "%d\n", numConnectors);
+    for (int i = 0; i < numConnectors; ++i) fprintf(file, "100 500\n");
+    fprintf(file, "%d\n", numConnectors);
+    for (int i = 0; i < numConnectors; ++i) fprintf(file, "100 500 5\n");
+    fprintf(file, "%d\n", numConnectors);
+    for (int i = 0; i < numConnectors; ++i) fprintf(file, "100 500\n");
+    long numCars = numSegments / pathLength;
+    fprintf(file, "%ld\n", numCars);
+    for (long car = 0; car < numCars; ++car) {
+        fprintf(file, "%ld %d\n", 10 + car % 90, pathLength);
+        for (int j = 0; j < pathLength; ++j) {
+            long k = car * 31 + j * 7;
+            fprintf(file, "%c%ld %ld %ld ", "NFC"[k % 3], k % numConnectors, k % 4, (k + 1) % 4);
+        }
+        fprintf(file, "\n");
+    }
+    fclose(file);
+}
+
+static bool SamePath(const PathSegment &a, const PathSegment &b) {
+    return a.type == b.type && a.id == b.id && a.from == b.from && a.to == b.to;
+}
+
+typedef std::chrono::steady_clock Clock;
+
+static double Seconds(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+int main(int argc, char *argv[]) {
+    long numSegments = argc > 1 ? atol(argv[1]) : 10000000;
+    int numThreads = argc > 2 ? atoi(argv[2]) : std::max(2u, std::thread::hardware_concurrency());
+    char path[] = "/tmp/bench_scenario_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) return 1;
+    close(fd);
+    WriteScenario(path, numSegments);
+
+    auto start = Clock::now();
+    std::vector<LegacyCar> legacy;
+    bool ok = freopen(path, "r", stdin) != NULL && LegacyReadScenario(std::cin, legacy);
+    double legacySeconds = Seconds(start);
+
+    Scenario scenarios[2];
+    double seconds[2];
+    int threadCounts[2] = { 1, numThreads };
+    for (int i = 0; i < 2; ++i) {
+        fd = open(path, O_RDONLY);
+        start = Clock::now();
+        ok = LoadScenario(fd, scenarios[i], threadCounts[i]) && ok;
+        seconds[i] = Seconds(start);
+        close(fd);
+    }
+    unlink(path);
+
+    for (const Scenario &scenario : scenarios) {
+        ok = ok && scenario.cars.size() == legacy.size();
+        for (size_t car = 0; ok && car < legacy.size(); ++car) {
+            std::span<const PathSegment> loaded = scenario.Path(scenario.cars[car]);
+            ok = loaded.size() == legacy[car].path.size() && scenario.cars[car].travelTime == legacy[car].travelTime;
+            for (size_t j = 0; ok && j < loaded.size(); ++j) ok = SamePath(loaded[j], legacy[car].path[j]);
+        }
+    }
+    if (!ok) {
+        fprintf(stderr, "loaded scenarios differ\n");
+        return 1;
+    }
+
+    printf("%-22s %10s %14s\n", "parser", "seconds", "segments/s");
+    printf("%-22s %10.3f %14.0f\n", "std::cin style", legacySeconds, numSegments / legacySeconds);
+    for (int i = 0; i < 2; ++i) {
+        char name[32];
+        snprintf(name, sizeof(name), "LoadScenario, %d thr", threadCounts[i]);
+        printf("%-22s %10.3f %14.0f\n", name, seconds[i], numSegments / seconds[i]);
+    }
+    return 0;
+}
@@ -0,0 +1,73 @@
+// Counts how often car threads are woken up for every car that gets through a connector.
+// Usage: bench_wakeups [cars] [travel time]
+// All cars arrive at one connector at once and queue up. Context switches come from
+// getrusage and include the threads that already exited. A car that only sleeps for its
+// turn, PASS_DELAY and its travel time needs a few voluntary switches. If that number grows
+// with the number of cars, cars are being woken up with nothing to do. Ferry cars fill loads
+// of FERRY_CAPACITY and should need about the same number per car as a bridge in one
+// direction. The trace is dropped.
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+#include <sys/resource.h>
+#include "connectors.h"
+
+#define FERRY_CAPACITY 10
+
+struct Workload {
+    const char *name;
+    char type;
+    int directions; // cars are spread round robin over this many directions
+};
+
+static void Run(const Workload &workload, int numCars, int travelTime) {
+    ConnectorArena<NarrowBridge> narrowBridges;
+    ConnectorArena<Ferry> ferries;
+    ConnectorArena<Crossroad> crossroads;
+    narrowBridges.Reserve(1);
+    ferries.Reserve(1);
+    crossroads.Reserve(1);
+    narrowBridges.Emplace(0, travelTime, 2000);
+    ferries.Emplace(0, travelTime, 2000, FERRY_CAPACITY);
+    crossroads.Emplace(0, travelTime, 2000);
+
+    struct rusage before, after;
+    getrusage(RUSAGE_SELF, &before);
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> cars;
+    for (int i = 0; i < numCars; ++i) {
+        cars.emplace_back([&, i] {
+            int direction = i % workload.directions;
+            if (workload.type == 'N') narrowBridges[0].Pass(i, direction);
+            else if (workload.type == 'F') ferries[0].Pass(i, direction);
+            else crossroads[0].Pass(i, direction);
+        });
+    }
+    for (auto& car : cars) car.join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    getrusage(RUSAGE_SELF, &after);
+
+    long voluntary = after.ru_nvcsw - before.ru_nvcsw;
+    long involuntary = after.ru_nivcsw - before.ru_nivcsw;
+    printf("%-22s %6d %8.2f %16.1f %18.1f\n", workload.name, numCars, seconds,
+           (double)voluntary / numCars, (double)involuntary / numCars);
+}
+
+int main(int argc, char *argv[]) {
+    int numCars = argc > 1 ? atoi(argv[1]) : 100;
+    int travelTime = argc > 2 ? atoi(argv[2]) : 20;
+
+    SetOutputMode(OUTPUT_NONE);
+    InitWriteOutput();
+    const Workload workloads[] = {
+        { "bridge, one direction", 'N', 1 },
+        { "bridge, two directions", 'N', 2 },
+        { "ferry, two sides", 'F', 2 },
+        { "crossroad, four ways", 'C', 4 },
+    };
+    printf("%-22s %6s %8s %16s %18s\n", "workload", "cars", "seconds", "voluntary/car", "involuntary/car");
+    for (const Workload &workload : workloads) Run(workload, numCars, travelTime);
+    return 0;
+}
@@ -0,0 +1,118 @@
+// Measures WriteOutput throughput in events per second.
+// Usage: bench_write_output [--verbose] [events per thread] [threads...]
+// The lines go to /dev/null. Before timing, a sample of lines is checked
+// byte for byte against the fprintf based formatter WriteOutput used to have,
+// which is also timed as a baseline.
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "WriteOutput.h"
+
+static pthread_mutex_t mutexLegacy = PTHREAD_MUTEX_INITIALIZER;
+
+// The previous WriteOutputf: one fprintf per thread id byte and one for the rest
+static void LegacyWrite(FILE *f, const unsigned char *tid, unsigned long long time,
+                        int carID, char connector_type, int connectorID, Action action) {
+    static const char *texts[] = { "traveling to connector.\n", "arrived at connector.\n",
+                                   "started passing connector.\n", "finished passing connector.\n" };
+    bool verbose = GetOutputMode() == OUTPUT_VERBOSE;
+    pthread_mutex_lock(&mutexLegacy);
+    if (verbose)
+        fprintf(f, "ThreadID: ");
+    for (size_t i = 0; i < 8; ++i)
+        fprintf(f, "%02x", tid[i]);
+    if (verbose)
+        fprintf(f, ", CarID: %d, Object: %c%d, time stamp: %llu, AID: %d %s", carID, connector_type, connectorID,
+                time, (int)action, texts[action]);
+    else
+        fprintf(f, " %d %c%d %llu %d\n", carID, connector_type, connectorID, time, (int)action);
+    pthread_mutex_unlock(&mutexLegacy);
+}
+
+static bool CheckIdentical() {
+    FILE *expected = tmpfile();
+    if (expected == NULL || freopen("/tmp/bench_write_output.txt", "w+", stdout) == NULL) return false;
+    const char types[] = { 'N', 'F', 'C' };
+    unsigned long long seed = 88172645463325252ULL;
+    for (int i = 0; i < 100000; ++i) {
+        seed ^= seed << 13; seed ^= seed >> 7; seed ^= seed << 17;
+        unsigned long long tid = seed;
+        unsigned long long time = (i % 4 == 0) ? i : seed >> (i % 44 + 20); // milliseconds that still fit in nanoseconds
+        int carID = (i % 5 == 0) ? -i : (int)(seed % 1000003);
+        int connectorID = (int)(seed >> 32) % 100 - (i % 7 == 0 ? 50 : 0);
+        Action action = (Action)(i % 4);
+        LegacyWrite(expected, (unsigned char*)&tid, time, carID, types[i % 3], connectorID, action);
+        WriteOutputAt(tid, time * 1000000, carID, types[i % 3], connectorID, action);
+    }
+    fflush(stdout);
+    fflush(expected);
+    rewind(expected);
+    FILE *actual = fopen("/tmp/bench_write_output.txt", "r");
+    bool same = actual != NULL;
+    int a, b;
+    do {
+        a = getc(expected);
+        b = same ? getc(actual) : EOF;
+        if (a != b) same = false;
+    } while (same && a != EOF);
+    if (actual) fclose(actual);
+    fclose(expected);
+    remove("/tmp/bench_write_output.txt");
+    return same;
+}
+
+struct Job {
+    long events;
+    bool legacy;
+};
+
+static void *Writer(void *arg) {
+    Job *job = (Job*)arg;
+    pthread_t self = pthread_self();
+    for (long i = 0; i < job->events; ++i) {
+        if (job->legacy)
+            LegacyWrite(stdout, (unsigned char*)&self, GetTimestamp(), (int)i, 'F', (int)(i & 63), (Action)(i & 3));
+        else
+            WriteOutput((int)i, 'F', (int)(i & 63), (Action)(i & 3));
+    }
+    return NULL;
+}
+
+static double Run(int numThreads, long events, bool legacy) {
+    std::vector<pthread_t> threads(numThreads);
+    Job job = { events, legacy };
+    auto start = std::chrono::steady_clock::now();
+    for (auto& thread : threads) pthread_create(&thread, NULL, Writer, &job);
+    for (auto& thread : threads) pthread_join(thread, NULL);
+    fflush(stdout);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return numThreads * events / seconds;
+}
+
+int main(int argc, char *argv[]) {
+    int arg = 1;
+    if (arg < argc && strcmp(argv[arg], "--verbose") == 0) {
+        SetOutputMode(OUTPUT_VERBOSE);
+        arg++;
+    }
+    long events = arg < argc ? atol(argv[arg++]) : 1000000;
+    std::vector<int> threadCounts;
+    for (; arg < argc; ++arg) threadCounts.push_back(atoi(argv[arg]));
+    if (threadCounts.empty()) threadCounts = { 1, 4, 16 };
+
+    InitWriteOutput();
+    if (!CheckIdentical()) {
+        fprintf(stderr, "WriteOutput differs from the fprintf formatter\n");
+        return 1;
+    }
+    if (freopen("/dev/null", "w", stdout) == NULL) return 1;
+    fprintf(stderr, "%8s %16s %16s\n", "threads", "fprintf ev/s", "WriteOutput ev/s");
+    for (int numThreads : threadCounts) {
+        double legacy = Run(numThreads, events, true);
+        double current = Run(numThreads, events, false);
+        fprintf(stderr, "%8d %16.0f %16.0f\n", numThreads, legacy, current);
+    }
+    return 0;
+}
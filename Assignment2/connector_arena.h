@@ -0,0 +1,53 @@
+#ifndef HOMEWORK2_CONNECTOR_ARENA_H
+#define HOMEWORK2_CONNECTOR_ARENA_H
+
+#include <cstdlib>
+#include <new>
+#include <stdexcept>
+#include <utility>
+
+#define CACHE_LINE_SIZE 64
+
+// Connectors are aligned to this, build with -DCONNECTOR_ALIGNMENT=8 to pack them like a plain array
+#ifndef CONNECTOR_ALIGNMENT
+#define CONNECTOR_ALIGNMENT CACHE_LINE_SIZE
+#endif
+
+//! Fixed size storage for connectors. Every element is constructed in place once and never
+//! moved or copied, so the mutexes inside stay valid and keep their address for the whole run.
+template <typename T>
+class ConnectorArena {
+    T *items;
+    size_t count;
+    size_t capacity;
+
+public:
+    ConnectorArena() : items(nullptr), count(0), capacity(0) {}
+    ConnectorArena(const ConnectorArena&) = delete;
+    ConnectorArena& operator=(const ConnectorArena&) = delete;
+
+    ~ConnectorArena() {
+        for (size_t i = 0; i < count; ++i) items[i].~T();
+        free(items);
+    }
+
+    //! Allocates room for n connectors, must be called once before Emplace
+    void Reserve(size_t n) {
+        capacity = n;
+        if (n > 0) {
+            items = static_cast<T*>(aligned_alloc(alignof(T), n * sizeof(T)));
+            if (items == nullptr) throw std::bad_alloc();
+        }
+    }
+
+    template <typename... Args>
+    T& Emplace(Args&&... args) {
+        if (count == capacity) throw std::length_error("ConnectorArena is full");
+        return *new (&items[count++]) T(std::forward<Args>(args)...);
+    }
+
+    T& operator[](size_t i) { return items[i]; }
+    size_t size() const { return count; }
+};
+
+#endif //HOMEWORK2_CONNECTOR_ARENA_H
@@ -0,0 +1,137 @@
+#include <algorithm>
+#include "connector_metrics.h"
+
+ConnectorMetrics::ConnectorMetrics(size_t bridges, const std::vector<int> &ferryCapacities, size_t crossroads)
+    : counts{ bridges, ferryCapacities.size(), crossroads }, capacities(ferryCapacities) {
+    firstIndex[0] = 0;
+    firstIndex[1] = counts[0];
+    firstIndex[2] = counts[0] + counts[1];
+    size_t total = counts[0] + counts[1] + counts[2];
+    totals = std::vector<Slot>(total);
+    startNs = GetTimestampNs();
+    occupancy.assign(total, Occupancy{ 0, 0, 0, startNs, 0, 0 });
+}
+
+// Adds one slot to another, the source is no longer written
+static void Merge(ConnectorMetrics::Slot &into, const ConnectorMetrics::Slot &from) {
+    ConnectorMetrics::Counters &sum = into.counters;
+    const ConnectorMetrics::Counters &c = from.counters;
+    for (int d = 0; d < 4; ++d) {
+        sum.waitCount[d] += c.waitCount[d];
+        sum.waitSumUs[d] += c.waitSumUs[d];
+        sum.waitMaxUs[d] = std::max(sum.waitMaxUs[d].load(), c.waitMaxUs[d].load());
+        for (int b = 0; b < METRICS_BUCKETS; ++b) into.histograms[d].buckets[b] += from.histograms[d].buckets[b];
+    }
+    sum.timeoutSwitches += c.timeoutSwitches;
+    sum.emptyQueueSwitches += c.emptyQueueSwitches;
+    sum.fullDepartures += c.fullDepartures;
+    sum.timeoutDepartures += c.timeoutDepartures;
+    sum.carsCarried += c.carsCarried;
+}
+
+ConnectorMetrics::Shard* ConnectorMetrics::Adopt() {
+    Shard *shard = new Shard;
+    shard->slots.resize(totals.size());
+    std::lock_guard<std::mutex> lock(shardsMutex);
+    live.push_back(shard);
+    return shard;
+}
+
+void ConnectorMetrics::Retire(Shard *shard) {
+    {
+        std::lock_guard<std::mutex> lock(shardsMutex);
+        for (size_t i = 0; i < shard->slots.size(); ++i) {
+            if (shard->slots[i]) Merge(totals[i], *shard->slots[i]);
+        }
+        live.erase(std::find(live.begin(), live.end(), shard));
+    }
+    delete shard;
+}
+
+ConnectorMetrics::ShardOwner::~ShardOwner() {
+    if (shard != nullptr) connectorMetrics->Retire(shard);
+}
+
+void EnableConnectorMetrics(size_t bridges, const std::vector<int> &ferryCapacities, size_t crossroads) {
+    connectorMetrics = new ConnectorMetrics(bridges, ferryCapacities, crossroads);
+}
+
+// Middle of the bucket that holds the given fraction of the values, but no more than the
+// largest value seen, in milliseconds
+static double Quantile(const WaitHistogram &histogram, unsigned long long count, unsigned long long maxUs,
+                       double fraction) {
+    unsigned long long rank = (unsigned long long)(fraction * (count - 1)), seen = 0;
+    for (int b = 0; b < METRICS_BUCKETS; ++b) {
+        seen += histogram.buckets[b];
+        if (seen > rank) {
+            double middle = (WaitHistogram::LowerBound(b) + WaitHistogram::LowerBound(b + 1)) / 2.0;
+            return std::min(middle, (double)maxUs) / 1000.0;
+        }
+    }
+    return maxUs / 1000.0;
+}
+
+void ConnectorMetrics::Write(FILE *file) {
+    unsigned long long end = GetTimestampNs();
+    double totalNs = end > startNs ? end - startNs : 1;
+    bool firstConnector = true;
+    std::lock_guard<std::mutex> lock(shardsMutex);
+    fprintf(file, "[\n");
+    for (int t = 0; t < 3; ++t) {
+        for (size_t id = 0; id < counts[t]; ++id) {
+            size_t index = firstIndex[t] + id;
+            Slot merged = {};
+            Merge(merged, totals[index]);
+            for (Shard *shard : live) { // Threads that never exit, like the timer wheel's
+                if (shard->slots[index]) Merge(merged, *shard->slots[index]);
+            }
+            const Counters &sum = merged.counters;
+
+            // Close the last interval at the end of the run
+            Occupancy o = occupancy[index];
+            unsigned long long elapsed = end > o.lastChange ? end - o.lastChange : 0;
+            o.waitingIntegral += elapsed * o.waiting;
+            if (o.waiting == 0 && o.passing == 0) o.idleNs += elapsed;
+
+            unsigned long long arrivals = 0;
+            for (int d = 0; d < 4; ++d) arrivals += sum.waitCount[d];
+            fprintf(file, "%s  {\"type\": \"%c\", \"id\": %zu, \"cars\": %llu, \"idle_ms\": %.1f,"
+                          " \"queue\": {\"mean\": %.3f, \"max\": %d}",
+                    firstConnector ? "" : ",\n", types[t], id, arrivals, o.idleNs / 1e6,
+                    o.waitingIntegral / totalNs, o.maxWaiting);
+            firstConnector = false;
+            if (types[t] == 'F') {
+                unsigned long long departures = sum.fullDepartures + sum.timeoutDepartures;
+                fprintf(file, ", \"departures\": {\"full\": %llu, \"timeout\": %llu}, \"fill_ratio\": %.3f",
+                        sum.fullDepartures.load(), sum.timeoutDepartures.load(),
+                        departures > 0 ? (double)sum.carsCarried / (departures * capacities[id]) : 0.0);
+            } else {
+                fprintf(file, ", \"switches\": {\"timeout\": %llu, \"queue_empty\": %llu}",
+                        sum.timeoutSwitches.load(), sum.emptyQueueSwitches.load());
+            }
+            fprintf(file, ", \"directions\": [");
+            bool firstDirection = true;
+            for (int d = 0; d < 4; ++d) {
+                unsigned long long count = sum.waitCount[d];
+                if (count == 0) continue;
+                fprintf(file, "%s{\"direction\": %d, \"cars\": %llu, \"wait_ms\": {\"mean\": %.3f, \"p50\": %.3f,"
+                              " \"p90\": %.3f, \"p99\": %.3f, \"max\": %.3f}}",
+                        firstDirection ? "" : ", ", d, count, (double)sum.waitSumUs[d] / count / 1000.0,
+                        Quantile(merged.histograms[d], count, sum.waitMaxUs[d], 0.5),
+                        Quantile(merged.histograms[d], count, sum.waitMaxUs[d], 0.9),
+                        Quantile(merged.histograms[d], count, sum.waitMaxUs[d], 0.99), sum.waitMaxUs[d] / 1000.0);
+                firstDirection = false;
+            }
+            fprintf(file, "]}");
+        }
+    }
+    fprintf(file, "\n]\n");
+}
+
+int WriteConnectorMetrics(const char *path) {
+    if (connectorMetrics == nullptr) return -1;
+    FILE *file = fopen(path, "w");
+    if (file == NULL) return -1;
+    connectorMetrics->Write(file);
+    return fclose(file) == 0 ? 0 : -1;
+}
@@ -0,0 +1,184 @@
+#ifndef HOMEWORK2_CONNECTOR_METRICS_H
+#define HOMEWORK2_CONNECTOR_METRICS_H
+
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "WriteOutput.h"
+#include "connector_arena.h"
+
+#define METRICS_SUB_BUCKET_BITS 2 // 4 buckets per power of two, about 25% resolution
+#define METRICS_BUCKETS 128 // Microseconds up to 2^32
+
+//! Wait time histogram with logarithmic buckets, in the style of an HDR histogram
+struct WaitHistogram {
+    std::atomic<unsigned int> buckets[METRICS_BUCKETS];
+
+    static int Bucket(unsigned long long us) {
+        if (us >> 32) us = 0xffffffffULL;
+        if (us < (1 << METRICS_SUB_BUCKET_BITS)) return us;
+        int exponent = 63 - __builtin_clzll(us);
+        int sub = (us >> (exponent - METRICS_SUB_BUCKET_BITS)) & ((1 << METRICS_SUB_BUCKET_BITS) - 1);
+        return ((exponent - METRICS_SUB_BUCKET_BITS + 1) << METRICS_SUB_BUCKET_BITS) + sub;
+    }
+    // Smallest value that falls into the bucket
+    static unsigned long long LowerBound(int bucket) {
+        if (bucket < (1 << METRICS_SUB_BUCKET_BITS)) return bucket;
+        int exponent = (bucket >> METRICS_SUB_BUCKET_BITS) + METRICS_SUB_BUCKET_BITS - 1;
+        int sub = bucket & ((1 << METRICS_SUB_BUCKET_BITS) - 1);
+        return (unsigned long long)((1 << METRICS_SUB_BUCKET_BITS) + sub) << (exponent - METRICS_SUB_BUCKET_BITS);
+    }
+};
+
+//! Per connector counters and histograms. Most of them live in shards, every thread that
+//! reports gets a shard of its own and only that thread writes it, so adding is a load and a
+//! store and cars never fight over a counter line. A shard is merged into the totals when its
+//! thread exits. Queue depth and idle time depend on the order of events, they are kept once
+//! per connector and only changed under the lock of that connector.
+//! Off unless EnableConnectorMetrics was called, the hooks below then cost a load and a branch.
+class ConnectorMetrics {
+public:
+    struct Counters {
+        std::atomic<unsigned long long> waitCount[4];
+        std::atomic<unsigned long long> waitSumUs[4];
+        std::atomic<unsigned long long> waitMaxUs[4];
+        std::atomic<unsigned long long> timeoutSwitches;
+        std::atomic<unsigned long long> emptyQueueSwitches;
+        std::atomic<unsigned long long> fullDepartures;
+        std::atomic<unsigned long long> timeoutDepartures;
+        std::atomic<unsigned long long> carsCarried;
+    };
+
+    //! What one thread counted for one connector
+    struct alignas(CACHE_LINE_SIZE) Slot {
+        Counters counters;
+        WaitHistogram histograms[4]; // By direction
+    };
+
+    //! The slots of one thread by connector index, made when the thread first reports on the connector
+    struct Shard {
+        std::vector<std::unique_ptr<Slot> > slots;
+    };
+
+    //! Merges the shard of the calling thread into the totals when the thread exits
+    struct ShardOwner {
+        Shard *shard = nullptr;
+        ~ShardOwner();
+    };
+
+    // Written under the lock of its connector by one car at a time, padded so that
+    // neighbouring connectors do not share a line
+    struct alignas(CACHE_LINE_SIZE) Occupancy {
+        int waiting; // Arrived but not started
+        int passing;
+        int maxWaiting;
+        unsigned long long lastChange; // ns
+        unsigned long long waitingIntegral; // Cars times ns, for the time weighted mean
+        unsigned long long idleNs;
+    };
+
+    char types[3] = { 'N', 'F', 'C' };
+    size_t counts[3]; // Connectors of each type
+    size_t firstIndex[3];
+    std::vector<int> capacities; // Of the ferries, for the fill ratio
+    std::mutex shardsMutex; // Guards totals and live
+    std::vector<Slot> totals; // Of the threads that exited
+    std::vector<Shard*> live; // Of the threads that are still running
+    std::vector<Occupancy> occupancy;
+    unsigned long long startNs;
+
+    ConnectorMetrics(size_t bridges, const std::vector<int> &ferryCapacities, size_t crossroads);
+
+    size_t Index(char type, int id) const {
+        return firstIndex[type == 'N' ? 0 : type == 'F' ? 1 : 2] + id;
+    }
+
+    Shard* Adopt(); // A new shard for the calling thread
+    void Retire(Shard *shard); // Adds the shard to the totals and frees it
+
+    Slot& Local(char type, int id) {
+        static thread_local ShardOwner owner;
+        if (owner.shard == nullptr) owner.shard = Adopt();
+        std::unique_ptr<Slot> &slot = owner.shard->slots[Index(type, id)];
+        if (!slot) slot.reset(new Slot());
+        return *slot;
+    }
+
+    // Only the owning thread writes a shard, a plain read and write is enough
+    static void Add(std::atomic<unsigned long long> &counter, unsigned long long value) {
+        counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+    // Called under the connector lock whenever a car arrives, starts or finishes
+    void Change(char type, int id, int waiting, int passing, unsigned long long now) {
+        Occupancy &o = occupancy[Index(type, id)];
+        unsigned long long elapsed = now > o.lastChange ? now - o.lastChange : 0;
+        o.waitingIntegral += elapsed * o.waiting;
+        if (o.waiting == 0 && o.passing == 0) o.idleNs += elapsed;
+        o.lastChange = now;
+        o.waiting += waiting;
+        o.passing += passing;
+        if (o.waiting > o.maxWaiting) o.maxWaiting = o.waiting;
+    }
+
+    void Wait(char type, int id, int direction, unsigned long long waitNs) {
+        Slot &slot = Local(type, id);
+        Counters &c = slot.counters;
+        unsigned long long us = waitNs / 1000;
+        Add(c.waitCount[direction], 1);
+        Add(c.waitSumUs[direction], us);
+        if (us > c.waitMaxUs[direction].load(std::memory_order_relaxed)) {
+            c.waitMaxUs[direction].store(us, std::memory_order_relaxed);
+        }
+        std::atomic<unsigned int> &bucket = slot.histograms[direction].buckets[WaitHistogram::Bucket(us)];
+        bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    // Writes all connectors as a JSON array, the totals and the live shards are summed up first
+    void Write(FILE *file);
+};
+
+inline ConnectorMetrics *connectorMetrics = nullptr;
+
+//! Starts collecting, must be called after InitWriteOutput and before the first car arrives
+void EnableConnectorMetrics(size_t bridges, const std::vector<int> &ferryCapacities, size_t crossroads);
+
+//! Writes the metrics as JSON, returns -1 if they were not enabled or the file failed
+int WriteConnectorMetrics(const char *path);
+
+// Hooks for the connectors. MetricsArrive returns the arrival time MetricsStart needs.
+inline unsigned long long MetricsArrive(char type, int id) {
+    if (connectorMetrics == nullptr) return 0;
+    unsigned long long now = GetTimestampNs();
+    connectorMetrics->Change(type, id, 1, 0, now);
+    return now;
+}
+
+inline void MetricsStart(char type, int id, int direction, unsigned long long arrived) {
+    if (connectorMetrics == nullptr) return;
+    unsigned long long now = GetTimestampNs();
+    connectorMetrics->Change(type, id, -1, 1, now);
+    connectorMetrics->Wait(type, id, direction, now > arrived ? now - arrived : 0);
+}
+
+inline void MetricsFinish(char type, int id) {
+    if (connectorMetrics == nullptr) return;
+    connectorMetrics->Change(type, id, 0, -1, GetTimestampNs());
+}
+
+inline void MetricsSwitch(char type, int id, bool timeout) {
+    if (connectorMetrics == nullptr) return;
+    ConnectorMetrics::Counters &c = connectorMetrics->Local(type, id).counters;
+    ConnectorMetrics::Add(timeout ? c.timeoutSwitches : c.emptyQueueSwitches, 1);
+}
+
+inline void MetricsDepart(int id, int cars, bool timeout) {
+    if (connectorMetrics == nullptr) return;
+    ConnectorMetrics::Counters &c = connectorMetrics->Local('F', id).counters;
+    ConnectorMetrics::Add(timeout ? c.timeoutDepartures : c.fullDepartures, 1);
+    ConnectorMetrics::Add(c.carsCarried, cars);
+}
+
+#endif //HOMEWORK2_CONNECTOR_METRICS_H
@@ -0,0 +1,186 @@
+#ifndef HOMEWORK2_CONNECTOR_RULES_H
+#define HOMEWORK2_CONNECTOR_RULES_H
+
+#include <deque>
+#include <vector>
+#include "scenario.h"
+#include "helper.h"
+
+// The connector rules for the engines that decide for the cars instead of letting every car
+// wait for its turn. The engine calls Arrive when a car reaches the connector, Finish when a
+// car leaves a crossing and Wake when a wake up the connector asked for is due. The rules
+// never wait, the Host template parameter brings the clock and the scheduler:
+//
+//   typedef Time              time stamps, a value initialized Time is the earliest one
+//   typedef Car               what the engine knows a waiting car by
+//   static Millis(int ms)     a duration that can be added to a Time
+//   Time Now()                the time of the event that is being handled
+//   void WakeAt(const ConnectorKey &key, Time time)
+//                             calls Wake on the connector at that time
+//   void StartPassing(Car car, const ConnectorKey &key, int travelTime)
+//                             the car starts at Now(), a crossing gets Finish after travelTime
+//   void CountSwitch()        a direction took over
+//   void CountDeparture(int cars, int capacity)
+
+//! What the engine knows a connector by
+struct ConnectorKey {
+    char type;
+    int id;
+    int slot; // Chosen by the engine, e.g. the index of the connector in its worker
+};
+
+//! Narrow bridges (2 directions) and crossroads (4 directions): one direction passes at a
+//! time, cars of that direction start in FIFO order PASS_DELAY apart, the direction changes
+//! when it runs out of cars or when a waiting direction exceeds maxWaitTime. The next
+//! direction is picked cyclically.
+template <class Host>
+class CrossingRules {
+    typedef typename Host::Time Time;
+    typedef typename Host::Car Car;
+
+    ConnectorKey key;
+    ConnectorSpec spec;
+    int numDirections;
+    int currentDirection;
+    int passingDirection; // direction of the cars on the connector
+    int carsPassing;
+    Time lastStart;
+    Time scheduledWake; // avoids queueing the same wake up more than once
+    std::deque<Car> queues[4];
+    Time deadlines[4]; // when a waiting direction times out
+
+public:
+    CrossingRules(const ConnectorKey &k, const ConnectorSpec &s, int directions)
+        : key(k), spec(s), numDirections(directions), currentDirection(-1), passingDirection(-1),
+          carsPassing(0), lastStart(), scheduledWake(), deadlines() {}
+
+    void Arrive(Host &host, Car car, int direction) {
+        queues[direction].push_back(car);
+        if (currentDirection == -1) {
+            currentDirection = direction;
+        } else if (direction != currentDirection && queues[direction].size() == 1) {
+            deadlines[direction] = host.Now() + Host::Millis(spec.maxWaitTime);
+            WakeAt(host, deadlines[direction]);
+        }
+        Dispatch(host);
+    }
+
+    void Finish(Host &host) {
+        if (--carsPassing == 0) passingDirection = -1;
+        Dispatch(host);
+    }
+
+    void Wake(Host &host) { Dispatch(host); }
+
+private:
+    void WakeAt(Host &host, Time time) {
+        if (time == scheduledWake) return;
+        scheduledWake = time;
+        host.WakeAt(key, time);
+    }
+
+    void SwitchTo(Host &host, int direction) {
+        host.CountSwitch();
+        currentDirection = direction;
+        for (int i = 0; i < numDirections; ++i) {
+            if (i != direction && !queues[i].empty()) {
+                deadlines[i] = host.Now() + Host::Millis(spec.maxWaitTime);
+                WakeAt(host, deadlines[i]);
+            }
+        }
+    }
+
+    // Switches to the next direction with waiting cars, returns false if there is none
+    bool SwitchToNext(Host &host) {
+        for (int step = 1; step < numDirections; ++step) {
+            int next = (currentDirection + step) % numDirections;
+            if (!queues[next].empty()) {
+                SwitchTo(host, next);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Starts the next car if it may start now, or asks for a wake up when it may
+    void Dispatch(Host &host) {
+        if (currentDirection == -1) return;
+        Time now = host.Now();
+
+        // A timed out direction takes over, the cars already passing finish first
+        for (int i = 0; i < numDirections; ++i) {
+            if (i != currentDirection && !queues[i].empty() && deadlines[i] <= now) {
+                SwitchToNext(host);
+                break;
+            }
+        }
+
+        if (queues[currentDirection].empty()) {
+            if (carsPassing > 0) return;
+            if (!SwitchToNext(host)) {
+                currentDirection = -1;
+                return;
+            }
+        }
+
+        if (passingDirection != -1 && passingDirection != currentDirection) return; // wait for the connector to clear
+        if (carsPassing > 0 && now < lastStart + Host::Millis(PASS_DELAY)) {
+            WakeAt(host, lastStart + Host::Millis(PASS_DELAY));
+            return;
+        }
+
+        Car car = queues[currentDirection].front();
+        queues[currentDirection].pop_front();
+        passingDirection = currentDirection;
+        carsPassing++;
+        lastStart = now;
+        host.StartPassing(car, key, spec.travelTime);
+        if (!queues[currentDirection].empty()) {
+            WakeAt(host, lastStart + Host::Millis(PASS_DELAY));
+        }
+    }
+};
+
+//! Ferries: cars on a side form a load, it departs when it is full or maxWaitTime after
+//! its first car arrived. Later cars start the next load. All cars of a load start at the
+//! same time.
+template <class Host>
+class FerryRules {
+    typedef typename Host::Time Time;
+    typedef typename Host::Car Car;
+
+    ConnectorKey key;
+    ConnectorSpec spec;
+    std::vector<Car> loads[2];
+    Time deadlines[2];
+
+public:
+    FerryRules(const ConnectorKey &k, const ConnectorSpec &s) : key(k), spec(s), deadlines() {}
+
+    void Arrive(Host &host, Car car, int side) {
+        loads[side].push_back(car);
+        if ((int)loads[side].size() >= spec.capacity) {
+            Depart(host, side);
+        } else if (loads[side].size() == 1) {
+            deadlines[side] = host.Now() + Host::Millis(spec.maxWaitTime);
+            host.WakeAt(key, deadlines[side]);
+        }
+    }
+
+    void Wake(Host &host) {
+        for (int side = 0; side < 2; ++side) {
+            if (!loads[side].empty() && deadlines[side] <= host.Now()) Depart(host, side);
+        }
+    }
+
+private:
+    void Depart(Host &host, int side) {
+        host.CountDeparture(loads[side].size(), spec.capacity);
+        for (size_t i = 0; i < loads[side].size(); ++i) {
+            host.StartPassing(loads[side][i], key, spec.travelTime);
+        }
+        loads[side].clear();
+    }
+};
+
+#endif //HOMEWORK2_CONNECTOR_RULES_H
@@ -0,0 +1,267 @@
+#ifndef HOMEWORK2_CONNECTORS_H
+#define HOMEWORK2_CONNECTORS_H
+
+#include <deque>
+#include <cerrno>
+#include <cstdio>
+#include "monitor.h"
+#include "WriteOutput.h"
+#include "helper.h"
+#include "connector_arena.h"
+#include "timer_wheel.h"
+#include "connector_metrics.h"
+
+// Function for resetting timestamp for timeout.
+inline void resetTimestamp(struct timespec* timestamp, int maxWaitTime) {
+    clock_gettime(CLOCK_MONOTONIC, timestamp); // Monitor conditions wait on CLOCK_MONOTONIC
+    timestamp->tv_sec += maxWaitTime / 1000;
+    timestamp->tv_nsec += (maxWaitTime % 1000) * 1000000;
+    if (timestamp->tv_nsec >= 1000000000) {
+        timestamp->tv_sec++;
+        timestamp->tv_nsec -= 1000000000;
+    }
+
+}
+
+// True once the CLOCK_MONOTONIC time t has passed.
+inline bool timestampReached(const struct timespec* t) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec > t->tv_sec || (now.tv_sec == t->tv_sec && now.tv_nsec >= t->tv_nsec);
+}
+
+// Narrow bridges (two directions) and crossroads (four directions) follow the same rules.
+// Cars of the current direction pass in arrival order, PASS_DELAY apart. When that direction
+// runs empty, or another one has waited maxWaitTime, the next waiting direction takes over
+// once the cars on the connector are done. Every car waits on its own condition in its queue,
+// so a pass wakes only the car behind it and a switch wakes only the heads of the queues.
+// The maxWaitTime deadlines are timers in the TimerWheel, which switches the direction when
+// one expires, so a waiting car never has to wake up just to check the clock.
+class alignas(CONNECTOR_ALIGNMENT) Crossing : public Monitor {
+private:
+    // Changed by every car with the monitor held, so it follows the mutex on its line
+    int currentDirection; // -1 while no car is waiting or passing
+    int passingDirection; // Direction of the cars on the connector, -1 when it is empty
+    int carsPassing;
+    struct timespec nextStart; // PASS_DELAY after the last car started
+    struct timespec deadlines[4]; // When each waiting direction times out
+    std::deque<Condition*> queues[4]; // The waiting cars of every direction
+    TimerWheel::Timer timeouts[4]; // Armed for deadlines while a direction waits
+    // Set once, on a line of its own that every cache can keep a clean copy of
+    alignas(CONNECTOR_ALIGNMENT) char type;
+    int connectorID;
+    int travelTime;
+    int maxWaitTime;
+    int numDirections;
+    TimerWheel *wheel; // The shard that keeps the deadlines
+
+public:
+    Crossing(char type, int id, int travelTime, int maxWaitTime, int directions)
+        : currentDirection(-1), passingDirection(-1), carsPassing(0), nextStart(), deadlines(),
+          timeouts{{DirectionTimeout, this, 0}, {DirectionTimeout, this, 1},
+                   {DirectionTimeout, this, 2}, {DirectionTimeout, this, 3}},
+          type(type), connectorID(id), travelTime(travelTime), maxWaitTime(maxWaitTime), numDirections(directions),
+          wheel(&TimerWheel::Pick()) {
+        profileAs(type == 'N' ? "N" : "C", id);
+    }
+
+    ~Crossing() {
+        for (int i = 0; i < numDirections; ++i) {
+            wheel->Cancel(&timeouts[i]);
+        }
+    }
+
+    void Pass(int carID, int direction) {
+        __synchronized__;
+        WriteOutput(carID, type, connectorID, ARRIVE);
+        unsigned long long arrived = MetricsArrive(type, connectorID);
+
+        Condition turn(this);
+        queues[direction].push_back(&turn);
+        if (currentDirection == -1) {
+            currentDirection = direction;
+        } else if (direction != currentDirection && queues[direction].size() == 1) {
+            startTimeout(direction);
+        }
+
+        while (true) {
+            bool atFront = queues[direction].front() == &turn;
+            if (atFront && direction == currentDirection && (carsPassing == 0 || passingDirection == direction)) {
+                if (carsPassing == 0 || timestampReached(&nextStart)) {
+                    break;
+                }
+                turn.timedwait(&nextStart); // Follow the car ahead after PASS_DELAY
+            } else {
+                turn.wait();
+            }
+        }
+
+        queues[direction].pop_front();
+        passingDirection = direction;
+        carsPassing++;
+        resetTimestamp(&nextStart, PASS_DELAY);
+        WriteOutput(carID, type, connectorID, START_PASSING);
+        MetricsStart(type, connectorID, direction, arrived);
+        wakeHead(direction); // The next car of this direction can follow
+        mutex.unlock();
+        sleep_milli(travelTime);
+        mutex.lock();
+        WriteOutput(carID, type, connectorID, FINISH_PASSING);
+        MetricsFinish(type, connectorID);
+
+        if (--carsPassing == 0) {
+            passingDirection = -1;
+            if (queues[currentDirection].empty()) {
+                switchToNext(false);
+            } else {
+                wakeHead(currentDirection); // It may have waited for the connector to clear
+            }
+        }
+    }
+
+private:
+    void wakeHead(int direction) {
+        if (!queues[direction].empty()) {
+            queues[direction].front()->notify();
+        }
+    }
+
+    void startTimeout(int direction) {
+        resetTimestamp(&deadlines[direction], maxWaitTime);
+        wheel->Arm(&timeouts[direction], &deadlines[direction]);
+    }
+
+    // Timer callback, a direction that waited too long hands the connector to the next waiting direction
+    static void DirectionTimeout(void *owner, int direction) {
+        Crossing *crossing = (Crossing*)owner;
+        Lock mutex(crossing);
+        // The timer may have been re-armed or become pointless since it fired
+        if (direction != crossing->currentDirection && !crossing->queues[direction].empty() &&
+            timestampReached(&crossing->deadlines[direction])) {
+            crossing->switchToNext(true);
+        }
+    }
+
+    // Moves to the next direction with waiting cars in cyclic order, or to none
+    void switchToNext(bool timeout) {
+        for (int step = 1; step < numDirections; ++step) {
+            int next = (currentDirection + step) % numDirections;
+            if (!queues[next].empty()) {
+                MetricsSwitch(type, connectorID, timeout);
+                currentDirection = next;
+                wheel->Disarm(&timeouts[next]);
+                for (int i = 0; i < numDirections; ++i) {
+                    if (i != next && !queues[i].empty()) {
+                        startTimeout(i);
+                    }
+                    wakeHead(i); // Every head has a new role or a new deadline
+                }
+                return;
+            }
+        }
+        if (queues[currentDirection].empty() && carsPassing == 0) {
+            currentDirection = -1;
+        }
+    }
+};
+
+class NarrowBridge : public Crossing {
+public:
+    NarrowBridge(int id, int travelTime, int maxWaitTime) : Crossing('N', id, travelTime, maxWaitTime, 2) {}
+};
+
+class Crossroad : public Crossing {
+public:
+    Crossroad(int id, int travelTime, int maxWaitTime) : Crossing('C', id, travelTime, maxWaitTime, 4) {}
+};
+
+// The cars of a side board the current batch. A batch leaves once, when it is full or when
+// the TimerWheel fires maxWaitTime after its first car came aboard, and a single notifyAll
+// releases all of its cars. Cars arriving after that start the next batch, which waits on
+// the other condition of the side, so a departure never wakes cars of a later batch.
+class alignas(CONNECTOR_ALIGNMENT) Ferry : public Monitor {
+private:
+    struct Batch {
+        unsigned long long number; // Batches that left this side before this one
+        int cars;
+        struct timespec departureTime; // maxWaitTime after the first car came aboard
+    };
+
+    // Changed by every car with the monitor held, so it follows the mutex on its line
+    Batch boarding[2]; // The batch each side is filling
+    Condition departed[2][2]; // By side and batch number parity
+    TimerWheel::Timer departureTimers[2]; // Armed for the departure time while a batch has cars
+    // Set once, on a line of its own that every cache can keep a clean copy of
+    alignas(CONNECTOR_ALIGNMENT) int connectorID;
+    int travelTime;
+    int maxWaitTime;
+    int capacity;
+    TimerWheel *wheel; // The shard that keeps the departure times
+
+public:
+    Ferry(int id, int travelTime, int maxWaitTime, int capacity)
+        : boarding(), departed{{Condition(this), Condition(this)}, {Condition(this), Condition(this)}},
+          departureTimers{{DepartureTimeout, this, 0}, {DepartureTimeout, this, 1}},
+          connectorID(id), travelTime(travelTime), maxWaitTime(maxWaitTime), capacity(capacity),
+          wheel(&TimerWheel::Pick()) {
+        profileAs("F", id);
+    }
+
+    ~Ferry() {
+        wheel->Cancel(&departureTimers[0]);
+        wheel->Cancel(&departureTimers[1]);
+    }
+
+    void Pass(int carID, int side) {
+        __synchronized__;
+
+        WriteOutput(carID, 'F', connectorID, ARRIVE);
+        unsigned long long arrived = MetricsArrive('F', connectorID);
+
+        Batch &batch = boarding[side];
+        unsigned long long number = batch.number;
+        if (++batch.cars == 1) {
+            resetTimestamp(&batch.departureTime, maxWaitTime);
+            wheel->Arm(&departureTimers[side], &batch.departureTime);
+        }
+
+        if (batch.cars >= capacity) {
+            wheel->Disarm(&departureTimers[side]);
+            depart(side, false);
+        }
+        while (batch.number == number) {
+            departed[side][number & 1].wait(); // Until the batch fills up or the timer sends it off
+        }
+        WriteOutput(carID, 'F', connectorID, START_PASSING);
+        MetricsStart('F', connectorID, side, arrived);
+        mutex.unlock();
+        sleep_milli(travelTime);
+        mutex.lock();
+        WriteOutput(carID, 'F', connectorID, FINISH_PASSING);
+        MetricsFinish('F', connectorID);
+    }
+
+private:
+    // Sends off the boarding batch of a side, the next car starts a new one
+    void depart(int side, bool timeout) {
+        Batch &batch = boarding[side];
+        MetricsDepart(connectorID, batch.cars, timeout);
+        departed[side][batch.number & 1].notifyAll();
+        batch.number++;
+        batch.cars = 0;
+    }
+
+    // Timer callback, sends off a batch that has waited maxWaitTime
+    static void DepartureTimeout(void *owner, int side) {
+        Ferry *ferry = (Ferry*)owner;
+        Lock mutex(ferry);
+        // A full batch may have left already and the next one may be waiting for a later time
+        const Batch &batch = ferry->boarding[side];
+        if (batch.cars > 0 && timestampReached(&batch.departureTime)) {
+            ferry->depart(side, true);
+        }
+    }
+};
+
+
+#endif //HOMEWORK2_CONNECTORS_H
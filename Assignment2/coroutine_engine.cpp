@@ -0,0 +1,402 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+#include <pthread.h>
+#include "coroutine_engine.h"
+#include "WriteOutput.h"
+#include "helper.h"
+#include "connector_rules.h"
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+Clock::time_point After(int milliseconds) {
+    return Clock::now() + std::chrono::milliseconds(milliseconds);
+}
+
+//! Runs ready coroutines on a fixed set of threads. Each worker has its own queue and
+//! steals from the others when it runs dry, idle workers sleep until work is scheduled.
+class Scheduler {
+    struct Worker {
+        std::mutex mutex;
+        std::deque<std::coroutine_handle<> > queue;
+    };
+    std::vector<std::unique_ptr<Worker> > workers;
+    std::vector<std::thread> threads;
+    std::atomic<long> queued;
+    std::atomic<int> idle;
+    std::atomic<unsigned> nextWorker;
+    std::atomic<bool> stopping;
+    std::mutex idleMutex;
+    std::condition_variable idleCond;
+    static thread_local int currentWorker;
+
+public:
+    explicit Scheduler(int numWorkers) : queued(0), idle(0), nextWorker(0), stopping(false) {
+        for (int i = 0; i < numWorkers; ++i) workers.emplace_back(new Worker);
+    }
+
+    void Start() {
+        for (size_t i = 0; i < workers.size(); ++i) threads.emplace_back(&Scheduler::Loop, this, i);
+    }
+
+    void Schedule(std::coroutine_handle<> handle) {
+        int target = currentWorker >= 0 ? currentWorker : nextWorker++ % workers.size();
+        {
+            std::lock_guard<std::mutex> lock(workers[target]->mutex);
+            workers[target]->queue.push_back(handle);
+        }
+        queued++;
+        if (idle > 0) {
+            std::lock_guard<std::mutex> lock(idleMutex);
+            idleCond.notify_one();
+        }
+    }
+
+    void Stop() {
+        std::lock_guard<std::mutex> lock(idleMutex);
+        stopping = true;
+        idleCond.notify_all();
+    }
+
+    void Join() {
+        for (auto &thread : threads) thread.join();
+    }
+
+private:
+    bool Take(int self, std::coroutine_handle<> &handle) {
+        for (size_t i = 0; i < workers.size(); ++i) {
+            Worker &worker = *workers[(self + i) % workers.size()];
+            std::lock_guard<std::mutex> lock(worker.mutex);
+            if (worker.queue.empty()) continue;
+            if (i == 0) { // own queue in order, stolen work from the other end
+                handle = worker.queue.front();
+                worker.queue.pop_front();
+            } else {
+                handle = worker.queue.back();
+                worker.queue.pop_back();
+            }
+            queued--;
+            return true;
+        }
+        return false;
+    }
+
+    void Loop(int self) {
+        currentWorker = self;
+        std::coroutine_handle<> handle;
+        while (true) {
+            if (Take(self, handle)) {
+                handle.resume();
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(idleMutex);
+            idle++;
+            idleCond.wait(lock, [this] { return stopping || queued > 0; });
+            idle--;
+            if (stopping) return;
+        }
+    }
+};
+
+thread_local int Scheduler::currentWorker = -1;
+
+//! One thread keeps the deadlines of sleeping coroutines and of connector wake ups.
+class TimerThread {
+    struct Timer {
+        Clock::time_point deadline;
+        unsigned long long seq;
+        std::coroutine_handle<> handle; // a sleeping coroutine
+        void (*callback)(void *owner);  // or a connector that asked for a wake up
+        void *owner;
+
+        bool operator>(const Timer &other) const {
+            return deadline != other.deadline ? deadline > other.deadline : seq > other.seq;
+        }
+    };
+    std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer> > timers;
+    std::mutex mutex;
+    std::condition_variable cond;
+    unsigned long long nextSeq;
+    bool stopping;
+    Scheduler &scheduler;
+    std::thread thread;
+
+public:
+    explicit TimerThread(Scheduler &s) : nextSeq(0), stopping(false), scheduler(s) {}
+
+    void Start() { thread = std::thread(&TimerThread::Loop, this); }
+
+    void Add(Clock::time_point deadline, std::coroutine_handle<> handle) {
+        Push(Timer{ deadline, 0, handle, nullptr, nullptr });
+    }
+
+    //! Calls callback(owner) on the timer thread once the deadline has passed
+    void Add(Clock::time_point deadline, void (*callback)(void *), void *owner) {
+        Push(Timer{ deadline, 0, std::coroutine_handle<>(), callback, owner });
+    }
+
+    void Stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+            cond.notify_one();
+        }
+        thread.join();
+    }
+
+private:
+    void Push(Timer timer) {
+        std::lock_guard<std::mutex> lock(mutex);
+        bool earliest = timers.empty() || timer.deadline < timers.top().deadline;
+        timer.seq = nextSeq++;
+        timers.push(timer);
+        if (earliest) cond.notify_one();
+    }
+
+    void Loop() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!stopping) {
+            if (timers.empty()) {
+                cond.wait(lock);
+                continue;
+            }
+            // A copy, Add may reallocate the heap while the wait has the lock dropped
+            Clock::time_point deadline = timers.top().deadline;
+            if (Clock::now() < deadline) {
+                cond.wait_until(lock, deadline);
+                continue;
+            }
+            Timer timer = timers.top();
+            timers.pop();
+            lock.unlock();
+            if (timer.callback) timer.callback(timer.owner);
+            else scheduler.Schedule(timer.handle);
+            lock.lock();
+        }
+    }
+};
+
+struct SleepAwaiter {
+    TimerThread *timer;
+    Clock::time_point deadline;
+    bool await_ready() { return Clock::now() >= deadline; }
+    void await_suspend(std::coroutine_handle<> handle) { timer->Add(deadline, handle); }
+    void await_resume() {}
+};
+
+//! Awaitable coroutine used for connector methods, resumes its caller when it finishes.
+class Task {
+public:
+    struct promise_type {
+        std::coroutine_handle<> continuation;
+
+        Task get_return_object() { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        struct FinalAwaiter {
+            bool await_ready() noexcept { return false; }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept {
+                return handle.promise().continuation;
+            }
+            void await_resume() noexcept {}
+        };
+        FinalAwaiter final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+
+    explicit Task(std::coroutine_handle<promise_type> h) : handle(h) {}
+    Task(Task &&other) : handle(other.handle) { other.handle = nullptr; }
+    ~Task() { if (handle) handle.destroy(); }
+
+    bool await_ready() { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) {
+        handle.promise().continuation = caller;
+        return handle;
+    }
+    void await_resume() {}
+
+private:
+    std::coroutine_handle<promise_type> handle;
+};
+
+//! Top level coroutine of a car, its frame is freed when the car is done.
+struct CarTask {
+    struct promise_type {
+        CarTask get_return_object() { return CarTask{ std::coroutine_handle<promise_type>::from_promise(*this) }; }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+    std::coroutine_handle<promise_type> handle;
+};
+
+struct Engine {
+    Scheduler scheduler;
+    TimerThread timer;
+    std::atomic<long> remainingCars;
+
+    Engine(int numWorkers, long numCars) : scheduler(numWorkers), timer(scheduler), remainingCars(numCars) {}
+
+    SleepAwaiter Sleep(int milliseconds) { return SleepAwaiter{ &timer, After(milliseconds) }; }
+    SleepAwaiter SleepUntil(Clock::time_point deadline) { return SleepAwaiter{ &timer, deadline }; }
+};
+
+typedef unsigned long long Nanoseconds; // GetTimestampNs time
+
+// The steady clock time at or after a GetTimestampNs time
+Clock::time_point ToClock(Nanoseconds time) {
+    Nanoseconds current = GetTimestampNs();
+    return Clock::now() + std::chrono::nanoseconds(time > current ? time - current : 0);
+}
+
+//! A car inside a connector, on the stack of its Pass coroutine.
+struct CarWaiter {
+    int carID;
+    std::coroutine_handle<> handle;
+    Nanoseconds finish; // Set when the rules start the car
+};
+
+//! A bridge, ferry or crossroad run by the connector rules. A car suspends once when it
+//! arrives and is resumed by the rules when it may start, so nothing wakes a car that cannot
+//! move. The mutex guards the rules for the short time an event takes and is never held
+//! across a suspension. Trace lines carry the time the rules decided with.
+class CoConnector {
+    Engine &engine;
+    ConnectorKey key;
+    std::mutex mutex;
+    Nanoseconds now; // Of the event that is being handled, mutex must be held
+    std::unique_ptr<CrossingRules<CoConnector> > crossing;
+    std::unique_ptr<FerryRules<CoConnector> > ferry;
+
+    struct ArriveAwaiter {
+        CoConnector *connector;
+        CarWaiter *car;
+        int direction;
+
+        bool await_ready() { return false; }
+        void await_suspend(std::coroutine_handle<> handle) {
+            // The car may be resumed on another worker as soon as the rules see it, after that
+            // only copies on this stack are used, not the awaiter in its frame
+            CoConnector *c = connector;
+            car->handle = handle;
+            std::lock_guard<std::mutex> lock(c->mutex);
+            c->now = GetTimestampNs();
+            c->Output(car->carID, ARRIVE);
+            if (c->ferry) c->ferry->Arrive(*c, car, direction);
+            else c->crossing->Arrive(*c, car, direction);
+        }
+        void await_resume() {}
+    };
+
+public:
+    typedef Nanoseconds Time;
+    typedef CarWaiter *Car;
+
+    CoConnector(Engine &e, const ConnectorKey &k, const ConnectorSpec &spec) : engine(e), key(k), now(0) {
+        if (key.type == 'F') ferry.reset(new FerryRules<CoConnector>(key, spec));
+        else crossing.reset(new CrossingRules<CoConnector>(key, spec, key.type == 'N' ? 2 : 4));
+    }
+
+    Task Pass(int carID, int direction) {
+        CarWaiter car = { carID, std::coroutine_handle<>(), 0 };
+        co_await ArriveAwaiter{ this, &car, direction };
+        co_await engine.SleepUntil(ToClock(car.finish));
+        if (ferry) {
+            WriteOutput(carID, key.type, key.id, FINISH_PASSING);
+            co_return;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        now = GetTimestampNs();
+        Output(carID, FINISH_PASSING);
+        crossing->Finish(*this);
+    }
+
+    // The host interface of the connector rules, called with mutex held
+    static Nanoseconds Millis(int milliseconds) { return milliseconds * 1000000ULL; }
+
+    Nanoseconds Now() const { return now; }
+
+    void WakeAt(const ConnectorKey &, Nanoseconds time) {
+        engine.timer.Add(ToClock(time), Woken, this);
+    }
+
+    void StartPassing(CarWaiter *car, const ConnectorKey &, int travelTime) {
+        car->finish = now + Millis(travelTime);
+        Output(car->carID, START_PASSING);
+        engine.scheduler.Schedule(car->handle);
+    }
+
+    void CountSwitch() {}
+    void CountDeparture(int, int) {}
+
+private:
+    void Output(int carID, Action action) {
+        WriteOutputAt((unsigned long long)pthread_self(), now, carID, key.type, key.id, action);
+    }
+
+    // Timer callback for WakeAt
+    static void Woken(void *owner) {
+        CoConnector *connector = (CoConnector*)owner;
+        std::lock_guard<std::mutex> lock(connector->mutex);
+        connector->now = GetTimestampNs();
+        if (connector->ferry) connector->ferry->Wake(*connector);
+        else connector->crossing->Wake(*connector);
+    }
+};
+
+struct Connectors {
+    std::vector<std::unique_ptr<CoConnector> > bridges;
+    std::vector<std::unique_ptr<CoConnector> > ferries;
+    std::vector<std::unique_ptr<CoConnector> > crossroads;
+};
+
+CarTask RunCar(Engine &engine, Connectors &connectors, const Scenario &scenario, int carID) {
+    const CarSpec &car = scenario.cars[carID];
+    for (const PathSegment &segment : scenario.Path(car)) {
+        WriteOutput(carID, segment.type, segment.id, TRAVEL);
+        co_await engine.Sleep(car.travelTime);
+
+        switch (segment.type) {
+            case 'C': co_await connectors.crossroads[segment.id]->Pass(carID, segment.from); break;
+            case 'F': co_await connectors.ferries[segment.id]->Pass(carID, segment.from); break;
+            case 'N': co_await connectors.bridges[segment.id]->Pass(carID, segment.to); break;
+        }
+    }
+    if (--engine.remainingCars == 0) engine.scheduler.Stop();
+}
+
+} // namespace
+
+void RunCoroutines(const Scenario &scenario, int numWorkers) {
+    if (numWorkers <= 0) numWorkers = std::max(1u, std::thread::hardware_concurrency());
+    if (scenario.cars.empty()) return;
+
+    Engine engine(numWorkers, scenario.cars.size());
+    Connectors connectors;
+    for (size_t i = 0; i < scenario.narrowBridges.size(); ++i)
+        connectors.bridges.emplace_back(new CoConnector(engine, ConnectorKey{ 'N', (int)i, (int)i }, scenario.narrowBridges[i]));
+    for (size_t i = 0; i < scenario.ferries.size(); ++i)
+        connectors.ferries.emplace_back(new CoConnector(engine, ConnectorKey{ 'F', (int)i, (int)i }, scenario.ferries[i]));
+    for (size_t i = 0; i < scenario.crossroads.size(); ++i)
+        connectors.crossroads.emplace_back(new CoConnector(engine, ConnectorKey{ 'C', (int)i, (int)i }, scenario.crossroads[i]));
+
+    InitWriteOutput();
+    for (size_t i = 0; i < scenario.cars.size(); ++i) {
+        engine.scheduler.Schedule(RunCar(engine, connectors, scenario, i).handle);
+    }
+    engine.timer.Start();
+    engine.scheduler.Start();
+    engine.scheduler.Join();
+    engine.timer.Stop();
+}
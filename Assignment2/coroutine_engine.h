@@ -0,0 +1,12 @@
+#ifndef HOMEWORK2_COROUTINE_ENGINE_H
+#define HOMEWORK2_COROUTINE_ENGINE_H
+
+#include "scenario.h"
+
+// Runs the scenario in real time with every car as a C++20 coroutine instead of a thread.
+// Cars are multiplexed onto a work-stealing pool of numWorkers threads (the core count if 0).
+// Cars waiting at a connector and sleeping cars are suspended instead of blocking a thread,
+// the connectors follow the rules in connector_rules.h and resume only the cars they start.
+void RunCoroutines(const Scenario &scenario, int numWorkers = 0);
+
+#endif //HOMEWORK2_COROUTINE_ENGINE_H
@@ -0,0 +1,145 @@
+#ifndef __FUTEX_MONITOR_H
+#define __FUTEX_MONITOR_H
+#include<errno.h>
+#include<limits.h>
+#include<time.h>
+#include<unistd.h>
+#include<linux/futex.h>
+#include<sys/syscall.h>
+#include "monitor_profile.h"
+
+#define MONITOR_MAX_SPIN 100 // upper bound for the adaptive spin before parking
+
+static inline long futex(int *uaddr, int op, int val, const struct timespec *timeout, int *uaddr2, int val3) {
+    return syscall(SYS_futex, uaddr, op, val, timeout, uaddr2, val3);
+}
+
+static inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+//! Same interface as the pthread Monitor, built directly on futexes.
+//! The lock word is 0 when free, 1 when held and 2 when held with threads parked on it.
+//! A thread spins for a while before parking, the spin length adapts to how long the
+//! lock usually takes to come free. Notified waiters are requeued from the condition
+//! onto the lock word, so they only wake up once the notifier has unlocked.
+class Monitor : public MonitorProfile {
+    int state;
+    int spinEstimate;
+
+    static bool canSpin() {
+        static const bool multiCore = sysconf(_SC_NPROCESSORS_ONLN) > 1;
+        return multiCore;
+    }
+
+    void acquire() {
+        int expected = 0;
+        if (__atomic_compare_exchange_n(&state, &expected, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) return;
+
+        if (canSpin()) {
+            int estimate = __atomic_load_n(&spinEstimate, __ATOMIC_RELAXED);
+            int limit = estimate * 2 + 10;
+            if (limit > MONITOR_MAX_SPIN) limit = MONITOR_MAX_SPIN;
+            for (int spins = 1; spins <= limit; ++spins) {
+                cpu_relax();
+                expected = 0;
+                if (__atomic_load_n(&state, __ATOMIC_RELAXED) == 0 &&
+                    __atomic_compare_exchange_n(&state, &expected, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+                    __atomic_store_n(&spinEstimate, estimate + (spins - estimate) / 8, __ATOMIC_RELAXED);
+                    return;
+                }
+            }
+            __atomic_store_n(&spinEstimate, estimate + (limit - estimate) / 8, __ATOMIC_RELAXED);
+        }
+        park();
+    }
+
+    // Marks the lock contended and sleeps until it is handed over
+    void park() {
+        while (__atomic_exchange_n(&state, 2, __ATOMIC_ACQUIRE) != 0) {
+            futex(&state, FUTEX_WAIT_PRIVATE, 2, NULL, NULL, 0);
+        }
+    }
+
+    bool tryAcquire() {
+        int expected = 0;
+        return __atomic_compare_exchange_n(&state, &expected, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+    }
+
+    void release() {
+        if (__atomic_exchange_n(&state, 0, __ATOMIC_RELEASE) == 2) {
+            futex(&state, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+        }
+    }
+
+public:
+    Monitor() : state(0), spinEstimate(0) {}
+
+    class Condition {
+        Monitor *owner;
+        int sequence; // bumped by every notify, a waiter sleeps while it is unchanged
+        int waiters;  // threads between the start and the end of a wait, changed with the lock held
+    public:
+        Condition(Monitor *o) : owner(o), sequence(0), waiters(0) {}
+        void wait() { timedwait(NULL); }
+        int timedwait(struct timespec *abstime) {  // abstime is on CLOCK_MONOTONIC, NULL waits forever
+#ifdef MONITOR_PROFILE
+            MonitorSiteStats *site = owner->suspend();
+#endif
+            int seen = __atomic_load_n(&sequence, __ATOMIC_RELAXED);
+            waiters++;
+            owner->release();
+            long result = futex(&sequence, FUTEX_WAIT_BITSET_PRIVATE, seen, abstime, NULL, FUTEX_BITSET_MATCH_ANY);
+            int timedOut = result == -1 && errno == ETIMEDOUT;
+            owner->park(); // after a requeue the lock word is what woke us, so it is contended
+            waiters--;
+#ifdef MONITOR_PROFILE
+            owner->resume(site);
+#endif
+            return timedOut ? ETIMEDOUT : 0;
+        }
+        void notify() { requeue(1); }
+        void notifyAll() { requeue(INT_MAX); }
+    private:
+        // Called with the lock held, so the sequence cannot move under us. Waiters are moved
+        // onto the lock word instead of being woken, the unlock of the notifier wakes the first.
+        void requeue(int count) {
+            int next = __atomic_add_fetch(&sequence, 1, __ATOMIC_RELAXED);
+            if (waiters == 0) return;
+            long moved = futex(&sequence, FUTEX_CMP_REQUEUE_PRIVATE, 0, (const struct timespec*)(long)count,
+                               &owner->state, next);
+            if (moved > 0) {
+                __atomic_store_n(&owner->state, 2, __ATOMIC_RELAXED);
+            }
+        }
+    };
+    class Lock {
+        Monitor *owner;
+    public:
+#ifdef MONITOR_PROFILE
+        Lock(Monitor *o, std::source_location site = std::source_location::current()) : owner(o) { lock(site); }
+        ~Lock() { unlock(); }
+        void lock(std::source_location site = std::source_location::current()) {
+            owner->profiledLock(site, [this] { return owner->tryAcquire(); }, [this] { owner->acquire(); });
+        }
+        void unlock() {
+            owner->profiledUnlock();
+            owner->release();
+        }
+#else
+        Lock(Monitor *o) { // we need monitor ptr to access the mutex
+            owner = o;
+            owner->acquire(); // lock on creation
+        }
+        ~Lock() {
+            owner->release(); // unlock on destruct
+        }
+        void lock() { owner->acquire();}
+        void unlock() { owner->release();}
+#endif
+    };
+};
+
+#endif
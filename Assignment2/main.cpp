@@ -1,397 +1,34 @@
 #include <queue>
 #include <iostream>
 #include <sstream>
+#include <cstring>
 #include <pthread.h>
-#include "monitor.h"
+#include <unistd.h>
 #include "WriteOutput.h"
 #include "helper.h"
-
-// Function for resetting timestamp for timeout.
-void resetTimestamp(struct timespec* timestamp, int maxWaitTime) {
-    clock_gettime(CLOCK_REALTIME, timestamp);
-    timestamp->tv_sec += maxWaitTime / 1000;
-    timestamp->tv_nsec += (maxWaitTime % 1000) * 1000000;
-    if (timestamp->tv_nsec >= 1000000000) {
-        timestamp->tv_sec++;
-        timestamp->tv_nsec -= 1000000000;
-    }
-
-}
-
-struct PathSegment {
-    char type;
-    int id;
-    int from;
-    int to;
-
-    PathSegment(char t, int i, int f, int to_dir) : type(t), id(i), from(f), to(to_dir) {}
-};
-
-
-class NarrowBridge : public Monitor {
-private:
-    struct timespec *timeout[2];
-    int connectorID;
-    int travelTime;
-    int maxWaitTime;
-    int currentDirection; // 0 or 1 indicating the current allowed direction
-    int carsOnBridge; // Number of cars currently on the bridge
-    std::queue<int> queues[2]; // Two queues for each direction
-    Condition *canPass[2]; // Condition variables for each direction
-
-public:
-    NarrowBridge(int id, int travelTime, int maxWaitTime)
-        : connectorID(id), travelTime(travelTime), maxWaitTime(maxWaitTime), currentDirection(-1), carsOnBridge(0) {
-        canPass[0] = new Condition(this);
-        canPass[1] = new Condition(this);
-        timeout[0] = new timespec();
-        timeout[1] = new timespec();
-    }
-
-    void Pass(int carID, int direction) {
-        __synchronized__;
-        // Enqueue the car in the appropriate queue
-        WriteOutput(carID, 'N', connectorID, ARRIVE);
-
-        queues[direction].push(carID);
-
-        if(currentDirection == -1){
-            currentDirection = direction;
-        }
-
-        if(queues[direction].front() == carID){
-            // Wait for the timeout (if it expires, switch direction and notify all cars in the new direction
-            resetTimestamp(timeout[direction], maxWaitTime);
-        }
-
-        while(true){
-            // Wait until it's this car's turn to pass and the direction is correct
-            while (queues[currentDirection].front() != carID || direction != currentDirection) {
-                if(direction == currentDirection){
-                    canPass[direction]->wait();
-                } else {
-                    int wait_result = canPass[direction]->timedwait(timeout[direction]);
-                    if (wait_result == ETIMEDOUT && direction != currentDirection && queues[direction].front() == carID) {
-                        currentDirection = 1 - currentDirection; // Switch direction
-                        while(carsOnBridge > 0){
-                            canPass[direction]->wait(); // Wait for the cars on the bridge to finish passing
-                        }
-                        // Reset the timeout and notify cars in the new direction
-                        resetTimestamp(timeout[1 - currentDirection], maxWaitTime);
-                        canPass[1 - currentDirection]->notifyAll(); // Wake up cars in the new direction
-                        canPass[currentDirection]->notifyAll(); // Wake up cars in the new direction
-                    }
-                }
-            }
-            
-            // Start passing
-
-            if(carsOnBridge > 0){
-                mutex.unlock();
-                sleep_milli(PASS_DELAY); // Simulate the time it takes to start passing
-                mutex.lock(); // Lock the monitor again
-            }
-
-            if(direction != currentDirection){
-                continue;
-            }
-            
-            queues[direction].pop(); // Remove car from the queue
-
-            canPass[currentDirection]->notifyAll(); // Notify all other cars
-
-            WriteOutput(carID, 'N', connectorID, START_PASSING);
-            carsOnBridge++;
-            mutex.unlock(); // Unlock the monitor before passing
-            sleep_milli(travelTime);
-            mutex.lock(); // Lock the monitor again
-            carsOnBridge--;
-            WriteOutput(carID, 'N', connectorID, FINISH_PASSING);
-
-            // Check if queue is empty and change direction if necessary
-            if (queues[currentDirection].empty() && !queues[1 - currentDirection].empty() && carsOnBridge == 0) {
-                
-                currentDirection = 1 - currentDirection; // Switch direction
-
-                // Reset the timeout and notify cars in the new direction
-                resetTimestamp(timeout[1 - currentDirection], maxWaitTime);
-                canPass[1 - currentDirection]->notifyAll(); // Wake up cars in the new direction
-                canPass[currentDirection]->notifyAll(); // Wake up cars in the new direction
-            }
-            else if(queues[currentDirection].empty() && queues[1 - currentDirection].empty()){
-                currentDirection = -1;
-            }
-            else {
-                // Notify the next car in the current direction
-                if (!queues[currentDirection].empty()) {
-                    canPass[currentDirection]->notifyAll();
-                }
-            }
-            break;
-        }
-        
-    }
+#include "scenario.h"
+#include "connectors.h"
+#include "virtual_engine.h"
+#include "coroutine_engine.h"
+#include "actor_engine.h"
+
+// The connectors of a threaded run, owned by main instead of being globals
+struct Connectors {
+    ConnectorArena<Crossroad> crossroads;
+    ConnectorArena<Ferry> ferries;
+    ConnectorArena<NarrowBridge> narrowBridges;
 };
 
-
-class Ferry : public Monitor {
-private:
-    int connectorID;
-    int travelTime;
-    int maxWaitTime;
-    int capacity;
-    int carsOnFerry[2];
-    Condition *readyToDepart[2]; // Condition variables to manage departure for each side
-    struct timespec *departureTime[2]; // Time when the ferry should depart if not full for each side
-
-public:
-    Ferry(int id, int travelTime, int maxWaitTime, int capacity)
-        : connectorID(id), travelTime(travelTime), maxWaitTime(maxWaitTime), capacity(capacity) {
-        for (int i = 0; i < 2; ++i) {
-            readyToDepart[i] = new Condition(this);
-            carsOnFerry[i] = 0;
-            departureTime[i] = new timespec();
-        }
-    }
-
-    void Pass(int carID, int side) {
-        __synchronized__;
-
-        WriteOutput(carID, 'F', connectorID, ARRIVE);
-
-        carsOnFerry[side]++;
-
-        if(carsOnFerry[side] == 1){
-            resetTimestamp(departureTime[side], maxWaitTime);
-        }
-
-        while(true){
-            if(carsOnFerry[side] < capacity){
-                
-                int wait_result = readyToDepart[side]->timedwait(departureTime[side]);
-                if(wait_result == ETIMEDOUT){
-                    carsOnFerry[side] = 0;
-                    readyToDepart[side]->notifyAll();
-                    
-                }
-                WriteOutput(carID, 'F', connectorID, START_PASSING);
-                mutex.unlock();
-                sleep_milli(travelTime);
-                mutex.lock();
-                WriteOutput(carID, 'F', connectorID, FINISH_PASSING);
-                break;
-            }
-            else{
-                //Ferry wil pass now
-                carsOnFerry[side] = 0;
-                readyToDepart[side]->notifyAll();
-                WriteOutput(carID, 'F', connectorID, START_PASSING);
-                mutex.unlock();
-                sleep_milli(travelTime);
-                mutex.lock();                
-                WriteOutput(carID, 'F', connectorID, FINISH_PASSING);
-                break;
-            }
-        }
-
-        
-    }
-};
-
-
-class Crossroad : public Monitor {
-private:
-    int timingOut;
-    int connectorID;
-    int travelTime;
-    int maxWaitTime;
-    int currentDirection; // 0 to 3 indicating the current allowed direction
-    std::queue<int> queues[4]; // Four queues for each direction (N, S, E, W)
-    Condition *canPass[4]; // Condition variables for each direction
-    struct timespec *timeout;
-    int carsOnCross; // Number of cars currently on the crossroad
-
-public:
-    Crossroad(int id, int travelTime, int maxWaitTime)
-        : connectorID(id), travelTime(travelTime), maxWaitTime(maxWaitTime), currentDirection(-1), carsOnCross(0), timingOut(-1){
-        for (int i = 0; i < 4; i++) {
-            canPass[i] = new Condition(this);
-        }
-        timeout = new timespec();
-    }
-
-    void Pass(int carID, int direction) {
-        __synchronized__;
-        // Enqueue the car in the appropriate queue
-        WriteOutput(carID, 'C', connectorID, ARRIVE);
-        queues[direction].push(carID);
-
-        if (currentDirection == -1) {
-            currentDirection = direction;
-        }
-
-
-        if(currentDirection != direction){
-            if(queues[direction].front() == carID){
-                bool reset_time = true;
-                for(int i = 0; i < 4; i++){
-                    if(i != currentDirection && i != direction){
-                         if(!queues[i].empty()){
-                            reset_time = false;
-                            break;
-                         }
-                    }
-                }
-                if(reset_time){
-                    resetTimestamp(timeout, maxWaitTime);
-                    timingOut = carID;
-                }
-            }
-        }
-
-        while(true){
-            // Wait until it's this car's turn to pass and the direction is correct
-            while (queues[currentDirection].front() != carID || direction != currentDirection) {
-                
-                if(direction == currentDirection){//Not in front of the queue.            
-                    canPass[direction]->wait();                    
-                } else if(timingOut == carID) {
-                    int wait_result = canPass[direction]->timedwait(timeout);
-                    if (wait_result == ETIMEDOUT && direction != currentDirection && queues[direction].front() == carID) {
-                        printf("Timeout for car %d at crossroad %d\n", carID, connectorID);
-                        //Find the next direction with cars
-                        if(!queues[(currentDirection + 1) % 4].empty()){
-                            currentDirection = (currentDirection + 1) % 4; // Switch direction cyclically
-                            printf("Switching direction to %d\n", currentDirection);
-                            resetTimestamp(timeout, maxWaitTime);
-                        }
-                        else if(!queues[(currentDirection + 2) % 4].empty()){
-                            currentDirection = (currentDirection + 2) % 4; // Switch direction cyclically
-                            printf("Switching direction to %d\n", currentDirection);
-                            resetTimestamp(timeout, maxWaitTime);
-                        }
-                        else if (!queues[(currentDirection + 3) % 4].empty()){
-                            currentDirection = (currentDirection + 3) % 4; // Switch direction cyclically
-                            printf("Switching direction to %d\n", currentDirection);
-                            resetTimestamp(timeout, maxWaitTime);
-                        }
-
-                        for(int i = 0; i < 4; i++){
-                            if(i != currentDirection && !queues[i].empty()){
-                                timingOut = queues[i].front();
-                                break;
-                            }
-                        }
-                        for(int i = 0; i < 4; i++){
-                            if(i != currentDirection){
-                                canPass[i]->notifyAll(); // Wake up cars in the new direction
-                            }
-                        }
-                        
-                        while(carsOnCross > 0){
-                            canPass[currentDirection]->wait(); // Wait for the cars on the bridge to finish passing
-                        }
-                        canPass[currentDirection]->notifyAll(); // Wake up cars in the new direction
-                    }
-                }
-                else{
-                    canPass[direction]->wait();
-                }
-            }
-
-            // Start passing
-
-            if (carsOnCross > 0) {
-                mutex.unlock();
-                sleep_milli(PASS_DELAY); // Simulate the time it takes to start passing
-                mutex.lock(); // Lock the monitor again
-            }
-
-            if(direction != currentDirection){
-
-                continue;
-            }
-
-            queues[direction].pop(); // Remove car from the queue
-
-            canPass[direction]->notifyAll(); // Notify all other cars
-
-            WriteOutput(carID, 'C', connectorID, START_PASSING);
-            carsOnCross++;
-            mutex.unlock(); // Unlock the monitor before passing
-            sleep_milli(travelTime);
-            mutex.lock(); // Lock the monitor again
-            carsOnCross--;
-            WriteOutput(carID, 'C', connectorID, FINISH_PASSING);
-
-            // Check if queue is empty and change direction if necessary
-            if (queues[currentDirection].empty() && carsOnCross == 0) {
-                    int oldDirection = currentDirection;
-                if(!queues[(currentDirection + 1) % 4].empty()){
-                    currentDirection = (currentDirection + 1) % 4; // Switch direction cyclically
-                    resetTimestamp(timeout, maxWaitTime);
-                    for(int i = 0; i < 4; i++){
-                        if(i != currentDirection && !queues[i].empty()){
-                            timingOut = queues[i].front();
-                            break;
-                        }
-                    }
-                    canPass[0]->notifyAll(); // Wake up cars in the new direction
-                    canPass[1]->notifyAll(); // Wake up cars in the new direction
-                    canPass[2]->notifyAll(); // Wake up cars in the new direction
-                    canPass[3]->notifyAll(); // Wake up cars in the new direction
-                }
-                else if(!queues[(currentDirection + 2) % 4].empty()){
-                    currentDirection = (currentDirection + 2) % 4; // Switch direction cyclically
-                    resetTimestamp(timeout, maxWaitTime);
-                    for(int i = 0; i < 4; i++){
-                        if(i != currentDirection && !queues[i].empty()){
-                            timingOut = queues[i].front();
-                            break;
-                        }
-                    }
-                    canPass[0]->notifyAll(); // Wake up cars in the new direction
-                    canPass[1]->notifyAll(); // Wake up cars in the new direction
-                    canPass[2]->notifyAll(); // Wake up cars in the new direction
-                    canPass[3]->notifyAll(); // Wake up cars in the new direction
-                }
-                else if (!queues[(currentDirection + 3) % 4].empty()){
-                    currentDirection = (currentDirection + 3) % 4; // Switch direction cyclically
-                    resetTimestamp(timeout, maxWaitTime);
-                    for(int i = 0; i < 4; i++){
-                        if(i != currentDirection && !queues[i].empty()){
-                            timingOut = queues[i].front();
-                            break;
-                        }
-                    }
-                    canPass[0]->notifyAll(); // Wake up cars in the new direction
-                    canPass[1]->notifyAll(); // Wake up cars in the new direction
-                    canPass[2]->notifyAll(); // Wake up cars in the new direction
-                    canPass[3]->notifyAll(); // Wake up cars in the new direction
-                }
-                else {
-                    currentDirection = -1; 
-                }
-            } else if (!queues[currentDirection].empty()) {
-                canPass[currentDirection]->notify(); // Notify the next car in the current direction
-            }
-            break;
-        }
-    }
-};
-
-std::vector<Crossroad> crossroads;
-std::vector<Ferry> ferries;
-std::vector<NarrowBridge> narrowBridges;
-
 class Car {
 public:
     int carID;
     int travelTime;
     int pathLength;
-    std::vector<PathSegment> path; // Vector of path segments
+    std::span<const PathSegment> path; // Path segments, kept in the scenario
+    Connectors &connectors;
 
-    Car(int id, int tTime, int pLength, const std::vector<PathSegment>& p) : carID(id), travelTime(tTime), pathLength(pLength), path(p) {}
+    Car(int id, int tTime, std::span<const PathSegment> p, Connectors &c)
+        : carID(id), travelTime(tTime), pathLength(p.size()), path(p), connectors(c) {}
 
     void operate() {
         for (const auto& segment : path) {
@@ -403,13 +40,13 @@ public:
             // Depending on the type of connector, call the appropriate Pass function
             switch (segment.type) {
                 case 'C': // Crossroad
-                    crossroads[segment.id].Pass(carID, segment.from);
+                    connectors.crossroads[segment.id].Pass(carID, segment.from);
                     break;
                 case 'F': // Ferry
-                    ferries[segment.id].Pass(carID, segment.from);
+                    connectors.ferries[segment.id].Pass(carID, segment.from);
                     break;
                 case 'N': // NarrowBridge
-                    narrowBridges[segment.id].Pass(carID, segment.to);
+                    connectors.narrowBridges[segment.id].Pass(carID, segment.to);
                     break;
                 default:
                     std::cerr << "Unknown connector type: " << segment.type << std::endl;
@@ -434,63 +71,138 @@ void* carThreadFunction(void* arg) {
     return nullptr;
 }
 
-int main() {
-    int NC, NF, NN;  // Number of crossroads, ferries, and narrow bridges
+// Nanoseconds per printed time stamp unit, 0 for an unknown unit
+static unsigned long long TimestampUnit(const char *name) {
+    if (strcmp(name, "ms") == 0) return 1000000;
+    if (strcmp(name, "us") == 0) return 1000;
+    if (strcmp(name, "ns") == 0) return 1;
+    return 0;
+}
 
-    std::cin >> NN;
+// Writes out whatever the output mode still buffers
+static void FinishOutput() {
+    StopAsyncWriteOutput();
+    CloseBinaryTrace();
+}
 
-    // Initialize Narrow Bridges
-    for (int i = 0; i < NN; ++i) {
-        int travelTime, maxWaitTime;
-        std::cin >> travelTime >> maxWaitTime;
-        narrowBridges.emplace_back(i, travelTime, maxWaitTime);
+int main(int argc, char *argv[]) {
+    bool useVirtualTime = false;
+    bool useCoroutines = false;
+    bool useActors = false;
+    bool asyncOutput = false;
+    const char *binaryTrace = nullptr;
+    const char *metricsPath = nullptr;
+    int numWorkers = 0;
+    int loadThreads = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--virtual") == 0) {
+            useVirtualTime = true;
+        } else if (strcmp(argv[i], "--coroutines") == 0) {
+            useCoroutines = true;
+        } else if (strcmp(argv[i], "--actors") == 0) {
+            useActors = true;
+        } else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+            numWorkers = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--metrics") == 0 && i + 1 < argc) {
+            metricsPath = argv[++i];
+        } else if (strcmp(argv[i], "--load-threads") == 0 && i + 1 < argc) {
+            loadThreads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--async-output") == 0) {
+            asyncOutput = true;
+        } else if (strcmp(argv[i], "--verbose") == 0) {
+            SetOutputMode(OUTPUT_VERBOSE);
+        } else if (strcmp(argv[i], "--binary-trace") == 0 && i + 1 < argc) {
+            binaryTrace = argv[++i];
+        } else if (strcmp(argv[i], "--precision") == 0 && i + 1 < argc && TimestampUnit(argv[i + 1]) != 0) {
+            SetTimestampUnit(TimestampUnit(argv[++i]));
+        } else if (strcmp(argv[i], "--clock") == 0 && i + 1 < argc && strcmp(argv[i + 1], "tsc") == 0) {
+            if (SetClockSource(CLOCK_SOURCE_TSC) < 0) {
+                std::cerr << "No invariant TSC, using CLOCK_MONOTONIC." << std::endl;
+            }
+            i++;
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--virtual | --coroutines [--workers N] | --actors [--workers N]]"
+                      << " [--async-output | --verbose | --binary-trace FILE]"
+                      << " [--precision ms|us|ns] [--clock tsc] [--load-threads N]"
+                      << " [--metrics FILE] < input" << std::endl;
+            return 1;
+        }
     }
 
-    std::cin >> NF;
+    if (metricsPath != nullptr && (useVirtualTime || useCoroutines || useActors)) {
+        std::cerr << "--metrics is only collected by the threaded engine." << std::endl;
+        return 1;
+    }
 
-    // Initialize Ferries
-    for (int i = 0; i < NF; ++i) {
-        int travelTime, maxWaitTime, capacity;
-        std::cin >> travelTime >> maxWaitTime >> capacity;
-        ferries.emplace_back(i, travelTime, maxWaitTime, capacity);
+    Scenario scenario;
+    if (!LoadScenario(STDIN_FILENO, scenario, loadThreads)) {
+        std::cerr << "Invalid input." << std::endl;
+        return 1;
     }
 
-    std::cin >> NC;
+    if (binaryTrace != nullptr) {
+        if (OpenBinaryTrace(binaryTrace, scenario.narrowBridges.size(), scenario.ferries.size(),
+                            scenario.crossroads.size(), scenario.cars.size()) < 0) {
+            perror(binaryTrace);
+            return 1;
+        }
+    } else if (asyncOutput) {
+        StartAsyncWriteOutput();
+    }
+    if (useVirtualTime) {
+        RunVirtual(scenario);
+        FinishOutput();
+        return 0;
+    }
+    if (useCoroutines) {
+        RunCoroutines(scenario, numWorkers);
+        FinishOutput();
+        return 0;
+    }
+    if (useActors) {
+        RunActors(scenario, numWorkers);
+        FinishOutput();
+        return 0;
+    }
 
-    // Initialize Crossroads
-    for (int i = 0; i < NC; ++i) {
-        int travelTime, maxWaitTime;
-        std::cin >> travelTime >> maxWaitTime;
-        crossroads.emplace_back(i, travelTime, maxWaitTime);
+    Connectors connectors;
+    ConnectorArena<NarrowBridge> &narrowBridges = connectors.narrowBridges;
+    ConnectorArena<Ferry> &ferries = connectors.ferries;
+    ConnectorArena<Crossroad> &crossroads = connectors.crossroads;
+
+    // Initialize Narrow Bridges
+    narrowBridges.Reserve(scenario.narrowBridges.size());
+    for (size_t i = 0; i < scenario.narrowBridges.size(); ++i) {
+        narrowBridges.Emplace(i, scenario.narrowBridges[i].travelTime, scenario.narrowBridges[i].maxWaitTime);
     }
 
+    // Initialize Ferries
+    ferries.Reserve(scenario.ferries.size());
+    for (size_t i = 0; i < scenario.ferries.size(); ++i) {
+        ferries.Emplace(i, scenario.ferries[i].travelTime, scenario.ferries[i].maxWaitTime,
+                             scenario.ferries[i].capacity);
+    }
+
+    // Initialize Crossroads
+    crossroads.Reserve(scenario.crossroads.size());
+    for (size_t i = 0; i < scenario.crossroads.size(); ++i) {
+        crossroads.Emplace(i, scenario.crossroads[i].travelTime, scenario.crossroads[i].maxWaitTime);
+    }
 
-    int N;  // Number of cars
-    std::cin >> N;
+    int N = scenario.cars.size();  // Number of cars
     std::vector<pthread_t> carThreads(N);
 
     InitWriteOutput();  // Initialize the output writer
+    if (metricsPath != nullptr) {
+        std::vector<int> capacities;
+        for (const ConnectorSpec &ferry : scenario.ferries) capacities.push_back(ferry.capacity);
+        EnableConnectorMetrics(scenario.narrowBridges.size(), capacities, scenario.crossroads.size());
+    }
 
     // Initialize Cars
     for (int i = 0; i < N; ++i) {
-        int travelTime;
-        int pathLength;
-        std::cin >> travelTime >> pathLength;
-
-        std::vector<PathSegment> path;
-
-        std::string typeID;
-        int from, to;
-        std::string pathStream;
-        for(int i = 0; i < pathLength; i++) {
-            std::cin >> typeID >> from >> to;
-            char type = typeID[0];
-            int id = std::stoi(typeID.substr(1));
-            path.emplace_back(type, id, from, to);
-        }
-
-     
-        Car* car = new Car(i, travelTime, pathLength, path);  // Create a car dynamically
+        const CarSpec &spec = scenario.cars[i];
+        Car* car = new Car(i, spec.travelTime, scenario.Path(spec), connectors);  // Create a car dynamically
         ThreadData* data = new ThreadData;
         data->car = car;
 
@@ -501,6 +213,11 @@ int main() {
     for (auto& thread : carThreads) {
         pthread_join(thread, nullptr);
     }
+    FinishOutput();
+    if (metricsPath != nullptr && WriteConnectorMetrics(metricsPath) < 0) {
+        perror(metricsPath);
+        return 1;
+    }
 
     return 0;
-}
\ No newline at end of file
+}
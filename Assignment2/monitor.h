@@ -1,9 +1,17 @@
 #ifndef __MONITOR_H
 #define __MONITOR_H
+#include "monitor_profile.h"
+
+// Build with -DMONITOR_FUTEX for the futex based Monitor with the same interface,
+// -DMONITOR_PROFILE for lock wait and hold times of either one (see monitor_profile.h)
+#ifdef MONITOR_FUTEX
+#include "futex_monitor.h"
+#else
 #include<pthread.h>
+#include<time.h>
 
 //! A base class to help deriving monitor like classes 
-class Monitor {
+class Monitor : public MonitorProfile {
     pthread_mutex_t  mut;   // this will protect the monitor
 public:
     Monitor() {
@@ -15,16 +23,47 @@ public:
     public:
         Condition(Monitor *o) {     // we need monitor ptr to access the mutex
                 owner = o;
-                pthread_cond_init(&cond, NULL) ; 
+                pthread_condattr_t attr;
+                pthread_condattr_init(&attr);
+                pthread_condattr_setclock(&attr, CLOCK_MONOTONIC); // timedwait deadlines are CLOCK_MONOTONIC
+                pthread_cond_init(&cond, &attr) ;
+                pthread_condattr_destroy(&attr);
+        }
+#ifdef MONITOR_PROFILE
+        void wait() {
+            MonitorSiteStats *site = owner->suspend();
+            pthread_cond_wait(&cond, &owner->mut);
+            owner->resume(site);
+        }
+        int timedwait(struct timespec *abstime) {
+            MonitorSiteStats *site = owner->suspend();
+            int result = pthread_cond_timedwait(&cond, &owner->mut, abstime);
+            owner->resume(site);
+            return result;
         }
+#else
         void wait() {  pthread_cond_wait(&cond, &owner->mut);}
         int timedwait(struct timespec *abstime) { return pthread_cond_timedwait(&cond, &owner->mut, abstime); }
+#endif
         void notify() { pthread_cond_signal(&cond);}
         void notifyAll() { pthread_cond_broadcast(&cond);}
     };
     class Lock {
         Monitor *owner;
     public:
+#ifdef MONITOR_PROFILE
+        // Every lock is recorded at the line that wrote it
+        Lock(Monitor *o, std::source_location site = std::source_location::current()) : owner(o) { lock(site); }
+        ~Lock() { unlock(); }
+        void lock(std::source_location site = std::source_location::current()) {
+            owner->profiledLock(site, [this] { return pthread_mutex_trylock(&owner->mut) == 0; },
+                                [this] { pthread_mutex_lock(&owner->mut); });
+        }
+        void unlock() {
+            owner->profiledUnlock();
+            pthread_mutex_unlock(&owner->mut);
+        }
+#else
         Lock(Monitor *o) { // we need monitor ptr to access the mutex
             owner = o;
             pthread_mutex_lock(&owner->mut); // lock on creation
@@ -34,9 +73,12 @@ public:
         }
         void lock() { pthread_mutex_lock(&owner->mut);}
         void unlock() { pthread_mutex_unlock(&owner->mut);}
+#endif
     };
 };
 
+#endif
+
 // when following is used as a local variable the 
 // method becomes a monitor method. On constructor
 // lock is acquired, when function returns, automatically
@@ -0,0 +1,257 @@
+#ifndef __MONITOR_PROFILE_H
+#define __MONITOR_PROFILE_H
+
+// Build with -DMONITOR_PROFILE to measure, for every monitor and every place that locks it,
+// how long threads waited to get the lock, how long they held it and how often the lock was
+// already taken. Time spent in Condition waits counts as neither. The tables are written to
+// stderr at exit, sorted by total wait. Without the flag MonitorProfile is an empty base and
+// Lock is the plain mutex lock.
+#ifdef MONITOR_PROFILE
+#include<pthread.h>
+#include<stdio.h>
+#include<string.h>
+#include<time.h>
+#include<algorithm>
+#include<map>
+#include<source_location>
+#include<string>
+#include<unordered_map>
+#include<vector>
+
+#define MONITOR_PROFILE_TOP 20 // Rows of the per monitor table, the busiest ones
+
+struct MonitorSiteStats {
+    unsigned long long acquisitions;
+    unsigned long long contended; // The lock was taken when the thread arrived
+    unsigned long long waitNs;
+    unsigned long long maxWaitNs;
+    unsigned long long holds; // Hold periods, a Condition wait ends one and starts another
+    unsigned long long holdNs;
+    unsigned long long maxHoldNs;
+
+    void lock(bool wasContended, unsigned long long waited) {
+        acquisitions++;
+        if (wasContended) contended++;
+        waitNs += waited;
+        if (waited > maxWaitNs) maxWaitNs = waited;
+    }
+
+    void add(const MonitorSiteStats &other) {
+        acquisitions += other.acquisitions;
+        contended += other.contended;
+        waitNs += other.waitNs;
+        maxWaitNs = std::max(maxWaitNs, other.maxWaitNs);
+        holds += other.holds;
+        holdNs += other.holdNs;
+        maxHoldNs = std::max(maxHoldNs, other.maxHoldNs);
+    }
+};
+
+inline unsigned long long MonitorProfileNow() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+//! Base of Monitor. The holder fields are only touched by the thread that holds the monitor.
+class MonitorProfile {
+    const char *profileName;
+    int profileId;
+    MonitorSiteStats *holder; // Where the current holder locked it
+    unsigned long long holdStart;
+
+public:
+    MonitorProfile() : profileName(nullptr), profileId(-1), holder(nullptr), holdStart(0) {}
+
+    //! Names the monitor in the report, name should be a string literal
+    void profileAs(const char *name, int id = -1) {
+        profileName = name;
+        profileId = id;
+    }
+
+    // Lock side, tryAcquire and acquire are the primitives of the monitor implementation
+    template <typename Try, typename Acquire>
+    void profiledLock(const std::source_location &site, Try tryAcquire, Acquire acquire);
+    void profiledUnlock() { suspend(); }
+
+    // Condition side, the hold ends before a wait and a new one starts once it returns
+    MonitorSiteStats *suspend();
+    void resume(MonitorSiteStats *stats) {
+        holder = stats;
+        holdStart = MonitorProfileNow();
+    }
+};
+
+//! Collects the statistics. Every thread keeps its own table, so recording only takes the
+//! table's own mutex, which nobody else wants until the report. Tables of finished threads
+//! are merged into the totals, the report at exit adds the ones still running.
+class MonitorProfiler {
+public:
+    struct Key {
+        const MonitorProfile *monitor;
+        const char *file;
+        unsigned int line;
+        const char *function;
+        const char *name; // Of the monitor when it was first locked here
+        int id;
+        bool operator==(const Key &other) const {
+            return monitor == other.monitor && file == other.file && line == other.line;
+        }
+    };
+    struct KeyHash {
+        size_t operator()(const Key &key) const {
+            return std::hash<const void*>()(key.monitor) ^ (std::hash<const void*>()(key.file) * 31 + key.line);
+        }
+    };
+    typedef std::unordered_map<Key, MonitorSiteStats, KeyHash> Sites;
+
+    struct Table {
+        pthread_mutex_t mut;
+        Sites sites;
+        Table() {
+            pthread_mutex_init(&mut, NULL);
+            Instance().attach(this);
+        }
+        ~Table() { Instance().detach(this); }
+    };
+
+    static MonitorProfiler &Instance() {
+        static MonitorProfiler profiler;
+        return profiler;
+    }
+
+    static Table &Local() {
+        static thread_local Table table;
+        return table;
+    }
+
+    ~MonitorProfiler() { report(stderr); }
+
+private:
+    pthread_mutex_t mut;
+    std::vector<Table*> tables; // Of the running threads
+    Sites finished;
+
+    MonitorProfiler() { pthread_mutex_init(&mut, NULL); }
+
+    void attach(Table *table) {
+        pthread_mutex_lock(&mut);
+        tables.push_back(table);
+        pthread_mutex_unlock(&mut);
+    }
+
+    void detach(Table *table) {
+        pthread_mutex_lock(&mut);
+        tables.erase(std::find(tables.begin(), tables.end(), table));
+        merge(table, finished);
+        pthread_mutex_unlock(&mut);
+    }
+
+    // Called with mut held
+    void merge(Table *table, Sites &into) {
+        pthread_mutex_lock(&table->mut);
+        for (auto &[key, stats] : table->sites) into[key].add(stats);
+        pthread_mutex_unlock(&table->mut);
+    }
+
+    // "static void Crossing::DirectionTimeout(void*, int)" at line 130 of connectors.h becomes
+    // "connectors.h:130 Crossing::DirectionTimeout"
+    static std::string siteName(const Key &key) {
+        const char *file = strrchr(key.file, '/');
+        const char *end = strchr(key.function, '(');
+        if (end == nullptr) end = key.function + strlen(key.function);
+        const char *name = end;
+        while (name > key.function && name[-1] != ' ') name--;
+        char text[256];
+        snprintf(text, sizeof(text), "%s:%u %.*s", file ? file + 1 : key.file, key.line, (int)(end - name), name);
+        return text;
+    }
+
+    // Monitors may be gone by now, so only the key is used
+    static std::string monitorName(const Key &key) {
+        char text[64];
+        if (key.name == nullptr) snprintf(text, sizeof(text), "%p", (const void*)key.monitor);
+        else if (key.id < 0) snprintf(text, sizeof(text), "%s", key.name);
+        else snprintf(text, sizeof(text), "%s%d", key.name, key.id);
+        return text;
+    }
+
+    static void printRows(FILE *file, const char *title, std::vector<std::pair<std::string, MonitorSiteStats>> &rows,
+                          size_t limit) {
+        std::sort(rows.begin(), rows.end(), [](const auto &a, const auto &b) {
+            return a.second.waitNs != b.second.waitNs ? a.second.waitNs > b.second.waitNs : a.second.holdNs > b.second.holdNs;
+        });
+        fprintf(file, "%-48s %10s %7s %12s %10s %10s %12s %10s %10s\n", title, "locks", "cont%", "wait ms",
+                "mean us", "max us", "hold ms", "mean us", "max us");
+        for (size_t i = 0; i < rows.size() && i < limit; ++i) {
+            const MonitorSiteStats &s = rows[i].second;
+            double n = s.acquisitions > 0 ? s.acquisitions : 1, holds = s.holds > 0 ? s.holds : 1;
+            fprintf(file, "%-48s %10llu %6.1f%% %12.3f %10.2f %10.1f %12.3f %10.2f %10.1f\n", rows[i].first.c_str(),
+                    s.acquisitions, 100.0 * s.contended / n, s.waitNs / 1e6, s.waitNs / n / 1e3, s.maxWaitNs / 1e3,
+                    s.holdNs / 1e6, s.holdNs / holds / 1e3, s.maxHoldNs / 1e3);
+        }
+        if (rows.size() > limit) fprintf(file, "... %zu more\n", rows.size() - limit);
+    }
+
+public:
+    void report(FILE *file) {
+        pthread_mutex_lock(&mut);
+        Sites all = finished;
+        for (Table *table : tables) merge(table, all);
+
+        std::map<std::string, MonitorSiteStats> bySite, byMonitor;
+        for (auto &[key, stats] : all) {
+            bySite[siteName(key)].add(stats);
+            byMonitor[monitorName(key)].add(stats);
+        }
+        pthread_mutex_unlock(&mut);
+        if (all.empty()) return;
+
+        std::vector<std::pair<std::string, MonitorSiteStats>> rows(bySite.begin(), bySite.end());
+        fprintf(file, "\nMonitor profile by call site\n");
+        printRows(file, "site", rows, rows.size());
+        rows.assign(byMonitor.begin(), byMonitor.end());
+        fprintf(file, "\nMonitor profile by monitor\n");
+        printRows(file, "monitor", rows, MONITOR_PROFILE_TOP);
+    }
+};
+
+template <typename Try, typename Acquire>
+void MonitorProfile::profiledLock(const std::source_location &site, Try tryAcquire, Acquire acquire) {
+    MonitorProfiler::Table &table = MonitorProfiler::Local();
+    unsigned long long start = MonitorProfileNow();
+    bool contended = !tryAcquire();
+    if (contended) acquire();
+    unsigned long long acquired = contended ? MonitorProfileNow() : start;
+
+    pthread_mutex_lock(&table.mut);
+    MonitorSiteStats &stats = table.sites[{ this, site.file_name(), site.line(), site.function_name(), profileName, profileId }];
+    stats.lock(contended, acquired - start);
+    pthread_mutex_unlock(&table.mut);
+    holder = &stats;
+    holdStart = acquired;
+}
+
+inline MonitorSiteStats *MonitorProfile::suspend() {
+    unsigned long long held = MonitorProfileNow() - holdStart;
+    MonitorSiteStats *stats = holder;
+    MonitorProfiler::Table &table = MonitorProfiler::Local(); // The holder locked it, so it is in this table
+    pthread_mutex_lock(&table.mut);
+    stats->holds++;
+    stats->holdNs += held;
+    if (held > stats->maxHoldNs) stats->maxHoldNs = held;
+    pthread_mutex_unlock(&table.mut);
+    holder = nullptr;
+    return stats;
+}
+
+#else
+
+class MonitorProfile {
+public:
+    void profileAs(const char *, int = -1) {}
+};
+
+#endif
+
+#endif
@@ -0,0 +1,244 @@
+#include <algorithm>
+#include <thread>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "scenario.h"
+
+#define PARSE_CHUNK_MIN (4 << 20) // Bytes of car section a loader thread gets at least
+
+namespace {
+
+inline bool IsSpace(char c) { return c == ' ' || c == '\n' || c == '\t' || c == '\r'; }
+inline bool IsDigit(char c) { return c >= '0' && c <= '9'; }
+inline bool IsLetter(char c) { return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z'); }
+
+// Reads whitespace separated tokens straight from the input buffer
+struct Scanner {
+    const char *p;
+    const char *end;
+
+    void SkipSpace() {
+        while (p < end && IsSpace(*p)) ++p;
+    }
+
+    // Integer starting right at p, it has to run up to whitespace or the end of the input
+    bool Number(int &value) {
+        bool negative = p < end && *p == '-';
+        if (negative) ++p;
+        if (p == end || !IsDigit(*p)) return false;
+        int v = 0;
+        while (p < end && IsDigit(*p)) v = v * 10 + (*p++ - '0');
+        value = negative ? -v : v;
+        return p == end || IsSpace(*p);
+    }
+
+    bool Int(int &value) {
+        SkipSpace();
+        return Number(value);
+    }
+
+    // A path segment: connector like N12, then from and to
+    bool Segment(PathSegment &segment) {
+        SkipSpace();
+        if (p == end || !IsLetter(*p)) return false;
+        segment.type = *p++;
+        return Number(segment.id) && Int(segment.from) && Int(segment.to);
+    }
+};
+
+// The car section tokens that start in [begin, end)
+struct Chunk {
+    const char *begin;
+    const char *end;
+    size_t numHeaders; // travelTime and pathLength values of the cars
+    size_t numSegments;
+    size_t firstHeader; // Where the chunk's values go in the joined arrays
+    size_t firstSegment;
+    bool ok;
+};
+
+// First token that starts after p
+const char *NextToken(const char *p, const char *end) {
+    while (p < end && !IsSpace(*p)) ++p;
+    while (p < end && IsSpace(*p)) ++p;
+    return p;
+}
+
+// How many tokens from p on are still the from and to of a segment that started before p
+int SegmentTail(const char *p, const char *sectionBegin) {
+    for (int back = 1; back <= 2; ++back) {
+        while (p > sectionBegin && IsSpace(p[-1])) --p;
+        if (p == sectionBegin) return 0;
+        while (p > sectionBegin && !IsSpace(p[-1])) --p;
+        if (IsLetter(*p)) return 3 - back;
+    }
+    return 0;
+}
+
+// Start of the first token of the chunk that is not the from or to of an earlier segment
+const char *ChunkStart(const Chunk &chunk, const char *sectionBegin, const char *fileEnd) {
+    const char *p = chunk.begin;
+    for (int tail = SegmentTail(chunk.begin, sectionBegin); tail > 0; --tail) {
+        p = NextToken(p, fileEnd);
+    }
+    return p;
+}
+
+// First pass, counts the segments and car header values that start in the chunk. Each segment
+// is a connector and two numbers, every other number belongs to a car header.
+void CountCars(Chunk &chunk, const char *sectionBegin, const char *fileEnd) {
+    size_t headers = 0, segments = 0;
+    int owed = 0; // Numbers still to come for the last segment
+    bool inToken = false;
+    for (const char *p = ChunkStart(chunk, sectionBegin, fileEnd); p < chunk.end; ++p) {
+        bool space = IsSpace(*p);
+        if (!space && !inToken) {
+            if (owed > 0) {
+                owed--;
+            } else if (IsLetter(*p)) {
+                segments++;
+                owed = 2;
+            } else {
+                headers++;
+            }
+        }
+        inToken = !space;
+    }
+    chunk.numHeaders = headers;
+    chunk.numSegments = segments;
+}
+
+// Second pass, parses the chunk straight into its place in the joined arrays
+void ParseCars(Chunk &chunk, const char *sectionBegin, const char *fileEnd, int *headers, PathSegment *segments) {
+    Scanner in = { ChunkStart(chunk, sectionBegin, fileEnd), fileEnd };
+    size_t numHeaders = 0, numSegments = 0;
+    chunk.ok = false;
+    while (true) {
+        in.SkipSpace();
+        if (in.p >= chunk.end) break;
+        if (IsLetter(*in.p)) {
+            if (numSegments == chunk.numSegments || !in.Segment(segments[numSegments++])) return;
+        } else {
+            if (numHeaders == chunk.numHeaders || !in.Number(headers[numHeaders++])) return;
+        }
+    }
+    chunk.ok = numHeaders == chunk.numHeaders && numSegments == chunk.numSegments;
+}
+
+// Runs work(i) for every chunk, chunk 0 on the calling thread
+template <typename Work>
+void ForEachChunk(std::vector<Chunk> &chunks, Work work) {
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < chunks.size(); ++i) {
+        threads.emplace_back(work, i);
+    }
+    work(0);
+    for (auto& thread : threads) thread.join();
+}
+
+} // namespace
+
+bool ParseScenario(const char *data, size_t size, Scenario &scenario, int numThreads) {
+    Scanner in = { data, data + size };
+    int NC, NF, NN;  // Number of crossroads, ferries, and narrow bridges
+
+    if (!in.Int(NN) || NN < 0) return false;
+    for (int i = 0; i < NN; ++i) {
+        int travelTime, maxWaitTime;
+        if (!in.Int(travelTime) || !in.Int(maxWaitTime)) return false;
+        scenario.narrowBridges.emplace_back(travelTime, maxWaitTime);
+    }
+
+    if (!in.Int(NF) || NF < 0) return false;
+    for (int i = 0; i < NF; ++i) {
+        int travelTime, maxWaitTime, capacity;
+        if (!in.Int(travelTime) || !in.Int(maxWaitTime) || !in.Int(capacity)) return false;
+        scenario.ferries.emplace_back(travelTime, maxWaitTime, capacity);
+    }
+
+    if (!in.Int(NC) || NC < 0) return false;
+    for (int i = 0; i < NC; ++i) {
+        int travelTime, maxWaitTime;
+        if (!in.Int(travelTime) || !in.Int(maxWaitTime)) return false;
+        scenario.crossroads.emplace_back(travelTime, maxWaitTime);
+    }
+
+    int N;  // Number of cars
+    if (!in.Int(N) || N < 0) return false;
+
+    // The rest is the car section, cut into chunks at token starts
+    const char *sectionBegin = in.p;
+    size_t sectionSize = in.end - sectionBegin;
+    if (numThreads <= 0) {
+        numThreads = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()),
+                                      sectionSize / PARSE_CHUNK_MIN + 1);
+    }
+    std::vector<Chunk> chunks(numThreads);
+    const char *begin = sectionBegin;
+    for (int i = 0; i < numThreads; ++i) {
+        const char *end = i + 1 == numThreads ? in.end : NextToken(sectionBegin + sectionSize * (i + 1) / numThreads, in.end);
+        chunks[i].begin = begin;
+        chunks[i].end = std::max(begin, end);
+        begin = chunks[i].end;
+    }
+    ForEachChunk(chunks, [&](size_t i) { CountCars(chunks[i], sectionBegin, in.end); });
+
+    size_t numHeaders = 0, numSegments = 0;
+    for (Chunk &chunk : chunks) {
+        chunk.firstHeader = numHeaders;
+        chunk.firstSegment = numSegments;
+        numHeaders += chunk.numHeaders;
+        numSegments += chunk.numSegments;
+    }
+    if (numHeaders != 2 * (size_t)N) return false;
+
+    // A header can be split over two chunks, so the values are paired up after both passes
+    std::vector<int> headers(numHeaders);
+    scenario.segments.resize(numSegments);
+    ForEachChunk(chunks, [&](size_t i) {
+        ParseCars(chunks[i], sectionBegin, in.end, headers.data() + chunks[i].firstHeader,
+                  scenario.segments.data() + chunks[i].firstSegment);
+    });
+    for (const Chunk &chunk : chunks) {
+        if (!chunk.ok) return false;
+    }
+
+    scenario.cars.resize(N);
+    size_t firstSegment = 0;
+    for (size_t car = 0; car < (size_t)N; ++car) {
+        int pathLength = headers[2 * car + 1];
+        if (pathLength < 0 || firstSegment + pathLength > numSegments) return false;
+        scenario.cars[car].travelTime = headers[2 * car];
+        scenario.cars[car].firstSegment = firstSegment;
+        scenario.cars[car].pathLength = pathLength;
+        firstSegment += pathLength;
+    }
+    return firstSegment == numSegments;
+}
+
+bool LoadScenario(int fd, Scenario &scenario, int numThreads) {
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            madvise(data, st.st_size, MADV_WILLNEED);
+            bool ok = ParseScenario((const char*)data, st.st_size, scenario, numThreads);
+            munmap(data, st.st_size);
+            return ok;
+        }
+    }
+
+    // A pipe or something else that cannot be mapped
+    std::vector<char> buffer;
+    size_t size = 0;
+    while (true) {
+        if (buffer.size() - size < 65536) buffer.resize(std::max<size_t>(buffer.size() * 2, 1 << 20));
+        ssize_t n = read(fd, buffer.data() + size, buffer.size() - size);
+        if (n < 0) return false;
+        if (n == 0) break;
+        size += n;
+    }
+    return ParseScenario(buffer.data(), size, scenario, numThreads);
+}
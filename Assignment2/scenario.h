@@ -0,0 +1,53 @@
+#ifndef HOMEWORK2_SCENARIO_H
+#define HOMEWORK2_SCENARIO_H
+
+#include <cstddef>
+#include <span>
+#include <vector>
+
+struct PathSegment {
+    char type;
+    int id;
+    int from;
+    int to;
+
+    PathSegment() = default;
+    PathSegment(char t, int i, int f, int to_dir) : type(t), id(i), from(f), to(to_dir) {}
+};
+
+struct ConnectorSpec {
+    int travelTime;
+    int maxWaitTime;
+    int capacity; // only used by ferries
+
+    ConnectorSpec(int tTime, int mWaitTime, int cap = 0) : travelTime(tTime), maxWaitTime(mWaitTime), capacity(cap) {}
+};
+
+struct CarSpec {
+    int travelTime;
+    size_t firstSegment; // Index of the first segment of the path in Scenario::segments
+    int pathLength;
+};
+
+//! Everything read from the input, so engines can be started after parsing is done.
+//! The paths of all cars lie back to back in one array instead of one vector per car.
+struct Scenario {
+    std::vector<ConnectorSpec> narrowBridges;
+    std::vector<ConnectorSpec> ferries;
+    std::vector<ConnectorSpec> crossroads;
+    std::vector<CarSpec> cars;
+    std::vector<PathSegment> segments;
+
+    std::span<const PathSegment> Path(const CarSpec &car) const {
+        return std::span<const PathSegment>(segments.data() + car.firstSegment, car.pathLength);
+    }
+};
+
+// Parses a scenario in the input format of the homework, returns false on malformed input.
+// The car section is split across numThreads threads, 0 picks a count from the input size.
+bool ParseScenario(const char *data, size_t size, Scenario &scenario, int numThreads = 0);
+
+// Maps the file behind fd (or reads it, if it is a pipe) and parses it with ParseScenario.
+bool LoadScenario(int fd, Scenario &scenario, int numThreads = 0);
+
+#endif //HOMEWORK2_SCENARIO_H
@@ -0,0 +1,193 @@
+// Writes a synthetic scenario in the input format of the simulator to stdout.
+// Usage: scenario_gen [--bridges N] [--ferries N] [--crossroads N] [--cars N]
+//                     [--capacity MIN[-MAX]] [--path-length MIN[-MAX]] [--path-dist uniform|geometric]
+//                     [--hotspot S] [--travel MIN[-MAX]] [--car-travel MIN[-MAX]]
+//                     [--max-wait MIN[-MAX]] [--seed N]
+// Ranges are inclusive and drawn uniformly. With --path-dist geometric, path lengths start
+// at MIN and every further segment is added with probability 1 - 1/(MAX - MIN + 1), so they
+// average about MAX but have a long tail. --hotspot picks connectors with a Zipf distribution
+// of exponent S, 0 (the default) spreads cars evenly and 1 or more piles them onto a few.
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#define GENERATOR_BUFFER_SIZE (1 << 20)
+
+struct Range {
+    int min;
+    int max;
+};
+
+// Accepts "N" and "MIN-MAX"
+static bool ParseRange(const char *text, Range &range) {
+    char *end;
+    range.min = strtol(text, &end, 10);
+    range.max = range.min;
+    if (*end == '-') range.max = strtol(end + 1, &end, 10);
+    return *end == '\0' && range.min >= 0 && range.max >= range.min;
+}
+
+// Buffered stdout with hand formatted integers, the files get large
+class Writer {
+    char buffer[GENERATOR_BUFFER_SIZE];
+    size_t used;
+public:
+    Writer() : used(0) {}
+    ~Writer() { Flush(); }
+
+    void Flush() {
+        fwrite(buffer, 1, used, stdout);
+        used = 0;
+    }
+    void Char(char c) {
+        if (used == sizeof(buffer)) Flush();
+        buffer[used++] = c;
+    }
+    void Int(long value) {
+        if (used + 24 > sizeof(buffer)) Flush();
+        char digits[24];
+        int n = 0;
+        do {
+            digits[n++] = '0' + value % 10;
+            value /= 10;
+        } while (value > 0);
+        while (n > 0) buffer[used++] = digits[--n];
+    }
+};
+
+// Connector indices drawn with P(i) proportional to 1 / (i + 1)^exponent
+class ConnectorPicker {
+    std::vector<double> cdf;
+public:
+    ConnectorPicker(int count, double exponent) : cdf(count) {
+        double sum = 0;
+        for (int i = 0; i < count; ++i) {
+            sum += 1.0 / pow(i + 1, exponent);
+            cdf[i] = sum;
+        }
+        for (double &p : cdf) p /= sum;
+    }
+    template <typename Random>
+    int Pick(Random &random) {
+        double u = std::uniform_real_distribution<double>(0, 1)(random);
+        return std::min<size_t>(std::lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin(), cdf.size() - 1);
+    }
+};
+
+int main(int argc, char *argv[]) {
+    int numBridges = 4, numFerries = 4, numCrossroads = 4, numCars = 100;
+    Range capacity = { 2, 5 }, pathLength = { 1, 5 }, travel = { 10, 50 }, carTravel = { 10, 100 }, maxWait = { 50, 200 };
+    bool geometric = false;
+    double hotspot = 0;
+    unsigned long seed = 1;
+    for (int i = 1; i < argc; i += 2) {
+        const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+        bool ok = true;
+        if (value == nullptr) {
+            ok = false;
+        } else if (strcmp(argv[i], "--bridges") == 0) {
+            numBridges = atoi(value);
+        } else if (strcmp(argv[i], "--ferries") == 0) {
+            numFerries = atoi(value);
+        } else if (strcmp(argv[i], "--crossroads") == 0) {
+            numCrossroads = atoi(value);
+        } else if (strcmp(argv[i], "--cars") == 0) {
+            numCars = atoi(value);
+        } else if (strcmp(argv[i], "--capacity") == 0) {
+            ok = ParseRange(value, capacity) && capacity.min > 0;
+        } else if (strcmp(argv[i], "--path-length") == 0) {
+            ok = ParseRange(value, pathLength);
+        } else if (strcmp(argv[i], "--path-dist") == 0) {
+            geometric = strcmp(value, "geometric") == 0;
+            ok = geometric || strcmp(value, "uniform") == 0;
+        } else if (strcmp(argv[i], "--hotspot") == 0) {
+            hotspot = atof(value);
+            ok = hotspot >= 0;
+        } else if (strcmp(argv[i], "--travel") == 0) {
+            ok = ParseRange(value, travel);
+        } else if (strcmp(argv[i], "--car-travel") == 0) {
+            ok = ParseRange(value, carTravel);
+        } else if (strcmp(argv[i], "--max-wait") == 0) {
+            ok = ParseRange(value, maxWait);
+        } else if (strcmp(argv[i], "--seed") == 0) {
+            seed = strtoul(value, nullptr, 10);
+        } else {
+            ok = false;
+        }
+        if (!ok || numBridges < 0 || numFerries < 0 || numCrossroads < 0 || numCars < 0) {
+            fprintf(stderr, "Usage: %s [--bridges N] [--ferries N] [--crossroads N] [--cars N]"
+                            " [--capacity MIN[-MAX]] [--path-length MIN[-MAX]] [--path-dist uniform|geometric]"
+                            " [--hotspot S] [--travel MIN[-MAX]] [--car-travel MIN[-MAX]]"
+                            " [--max-wait MIN[-MAX]] [--seed N]\n", argv[0]);
+            return 1;
+        }
+    }
+    int numConnectors = numBridges + numFerries + numCrossroads;
+    if (numConnectors == 0 && pathLength.max > 0) {
+        fprintf(stderr, "Paths need at least one connector.\n");
+        return 1;
+    }
+
+    std::mt19937_64 random(seed);
+    auto draw = [&](Range range) { return std::uniform_int_distribution<int>(range.min, range.max)(random); };
+    Writer out;
+
+    out.Int(numBridges);
+    out.Char('\n');
+    for (int i = 0; i < numBridges; ++i) {
+        out.Int(draw(travel)); out.Char(' '); out.Int(draw(maxWait)); out.Char('\n');
+    }
+    out.Int(numFerries);
+    out.Char('\n');
+    for (int i = 0; i < numFerries; ++i) {
+        out.Int(draw(travel)); out.Char(' '); out.Int(draw(maxWait)); out.Char(' '); out.Int(draw(capacity)); out.Char('\n');
+    }
+    out.Int(numCrossroads);
+    out.Char('\n');
+    for (int i = 0; i < numCrossroads; ++i) {
+        out.Int(draw(travel)); out.Char(' '); out.Int(draw(maxWait)); out.Char('\n');
+    }
+
+    // One picker over all connectors, so the hot spots are spread over the types
+    ConnectorPicker picker(std::max(numConnectors, 1), hotspot);
+    std::vector<int> shuffled(numConnectors);
+    for (int i = 0; i < numConnectors; ++i) shuffled[i] = i;
+    std::shuffle(shuffled.begin(), shuffled.end(), random);
+    std::geometric_distribution<int> extraSegments(1.0 / (pathLength.max - pathLength.min + 1));
+
+    out.Int(numCars);
+    out.Char('\n');
+    for (int car = 0; car < numCars; ++car) {
+        int length = geometric ? pathLength.min + extraSegments(random) : draw(pathLength);
+        out.Int(draw(carTravel)); out.Char(' '); out.Int(length); out.Char('\n');
+        for (int j = 0; j < length; ++j) {
+            int connector = shuffled[picker.Pick(random)];
+            char type;
+            int id, from, to;
+            if (connector < numBridges) {
+                type = 'N';
+                id = connector;
+                from = random() % 2;
+                to = 1 - from;
+            } else if (connector < numBridges + numFerries) {
+                type = 'F';
+                id = connector - numBridges;
+                from = random() % 2;
+                to = 1 - from;
+            } else {
+                type = 'C';
+                id = connector - numBridges - numFerries;
+                from = random() % 4;
+                to = (from + 1 + random() % 3) % 4;
+            }
+            if (j > 0) out.Char(' ');
+            out.Char(type); out.Int(id); out.Char(' '); out.Int(from); out.Char(' '); out.Int(to);
+        }
+        out.Char('\n');
+    }
+    return 0;
+}
@@ -0,0 +1,266 @@
+// Runs a base scenario under every combination of parameter values and prints one summary
+// row per configuration as CSV or JSON.
+// Usage: sweep [--jobs N] [--format csv|json] --param NAME=VALUES [--param ...] [scenario]
+// NAME is N, F or C with an optional connector id, then .travel, .maxWait or .capacity
+// (ferries only), or car.travel. Without an id every connector of the type gets the value.
+// VALUES is a list "10,20,50" or an inclusive range "START:END:STEP". For example
+//   sweep --param F.capacity=2:8:2 --param N.maxWait=50,100,200 < input.txt
+// runs 12 configurations. The scenario is read from stdin if no file is given.
+// Every configuration runs on the virtual clock in an engine of its own, the runs are spread
+// over --jobs threads (all CPUs by default). They share nothing but the base scenario, which
+// is only read, so the table does not depend on the number of jobs.
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include "scenario.h"
+#include "virtual_engine.h"
+
+struct Parameter {
+    std::string name;
+    char type; // N, F, C or 'c' for the cars
+    int id; // -1 for all connectors of the type
+    int field; // 0 travel time, 1 max wait time, 2 capacity
+    std::vector<int> values;
+};
+
+struct Row {
+    unsigned long long cars;
+    unsigned long long events;
+    unsigned long long makespan;
+    double latencyMean, latencyP50, latencyP90, latencyP99, latencyMax;
+    double waitMean[3];
+    double waitP99, waitMax;
+    unsigned long long switches;
+    unsigned long long departures;
+    double fill;
+};
+
+static const char *fieldNames[] = { "travel", "maxWait", "capacity" };
+
+// One number of a value list, false if there are no digits (an empty element would read as 0)
+static bool ParseNumber(const char *text, char **end, long &value) {
+    value = strtol(text, end, 10);
+    return *end != text;
+}
+
+// Parses NAME=VALUES, see the usage above
+static bool ParseParameter(const char *text, Parameter &parameter) {
+    const char *equals = strchr(text, '=');
+    const char *dot = strchr(text, '.');
+    if (equals == nullptr || dot == nullptr || dot > equals) return false;
+    parameter.name.assign(text, equals - text);
+
+    std::string target(text, dot - text), field(dot + 1, equals - dot - 1);
+    if (target == "car") {
+        parameter.type = 'c';
+        parameter.id = -1;
+    } else if (target[0] == 'N' || target[0] == 'F' || target[0] == 'C') {
+        parameter.type = target[0];
+        char *end;
+        parameter.id = target.size() > 1 ? strtol(target.c_str() + 1, &end, 10) : -1;
+        if (target.size() > 1 && (*end != '\0' || parameter.id < 0)) return false;
+    } else {
+        return false;
+    }
+    parameter.field = -1;
+    for (int i = 0; i < 3; ++i) {
+        if (field == fieldNames[i]) parameter.field = i;
+    }
+    if (parameter.field < 0 || (parameter.type == 'c' && parameter.field != 0) ||
+        (parameter.field == 2 && parameter.type != 'F')) {
+        return false;
+    }
+
+    char *end;
+    long start, stop, step = 1, value;
+    if (!ParseNumber(equals + 1, &end, start)) return false;
+    if (*end == ':') {
+        if (!ParseNumber(end + 1, &end, stop)) return false;
+        if (*end == ':' && !ParseNumber(end + 1, &end, step)) return false;
+        if (*end != '\0' || step <= 0 || stop < start) return false;
+        for (long v = start; v <= stop; v += step) parameter.values.push_back(v);
+    } else {
+        parameter.values.push_back(start);
+        while (*end == ',') {
+            if (!ParseNumber(end + 1, &end, value)) return false;
+            parameter.values.push_back(value);
+        }
+        if (*end != '\0') return false;
+    }
+    int least = parameter.field == 2 ? 1 : 0;
+    return std::all_of(parameter.values.begin(), parameter.values.end(), [least](int v) { return v >= least; });
+}
+
+static void Apply(const Parameter &parameter, int value, Scenario &scenario) {
+    if (parameter.type == 'c') {
+        for (CarSpec &car : scenario.cars) car.travelTime = value;
+        return;
+    }
+    std::vector<ConnectorSpec> &specs = parameter.type == 'N' ? scenario.narrowBridges
+                                      : parameter.type == 'F' ? scenario.ferries : scenario.crossroads;
+    size_t first = parameter.id < 0 ? 0 : parameter.id, last = parameter.id < 0 ? specs.size() : parameter.id + 1;
+    for (size_t i = first; i < last; ++i) {
+        int &field = parameter.field == 0 ? specs[i].travelTime : parameter.field == 1 ? specs[i].maxWaitTime
+                                                                                      : specs[i].capacity;
+        field = value;
+    }
+}
+
+static double Percentile(std::vector<unsigned long long> &values, double p) {
+    if (values.empty()) return 0;
+    size_t k = std::min(values.size() - 1, (size_t)(p / 100 * values.size()));
+    std::nth_element(values.begin(), values.begin() + k, values.end());
+    return values[k];
+}
+
+static double Mean(const std::vector<unsigned long long> &values) {
+    if (values.empty()) return 0;
+    double sum = 0;
+    for (unsigned long long v : values) sum += v;
+    return sum / values.size();
+}
+
+static Row Summarize(VirtualSummary &summary, size_t cars) {
+    Row row = {};
+    row.cars = cars;
+    row.events = summary.events;
+    row.makespan = summary.makespan;
+    row.latencyMean = Mean(summary.latencies);
+    row.latencyP50 = Percentile(summary.latencies, 50);
+    row.latencyP90 = Percentile(summary.latencies, 90);
+    row.latencyP99 = Percentile(summary.latencies, 99);
+    row.latencyMax = Percentile(summary.latencies, 100);
+    std::vector<unsigned long long> waits;
+    for (int t = 0; t < 3; ++t) {
+        row.waitMean[t] = Mean(summary.waits[t]);
+        waits.insert(waits.end(), summary.waits[t].begin(), summary.waits[t].end());
+    }
+    row.waitP99 = Percentile(waits, 99);
+    row.waitMax = Percentile(waits, 100);
+    row.switches = summary.directionSwitches;
+    row.departures = summary.ferryDepartures;
+    row.fill = summary.ferrySeats > 0 ? (double)summary.ferryCars / summary.ferrySeats : 0;
+    return row;
+}
+
+// Values of every parameter for configuration index, the last parameter changes fastest
+static std::vector<int> Configuration(const std::vector<Parameter> &parameters, size_t index) {
+    std::vector<int> values(parameters.size());
+    for (size_t p = parameters.size(); p-- > 0;) {
+        values[p] = parameters[p].values[index % parameters[p].values.size()];
+        index /= parameters[p].values.size();
+    }
+    return values;
+}
+
+static void PrintCsv(const std::vector<Parameter> &parameters, const std::vector<Row> &rows) {
+    printf("run");
+    for (const Parameter &parameter : parameters) printf(",%s", parameter.name.c_str());
+    printf(",cars,events,makespan_ms,latency_mean_ms,latency_p50_ms,latency_p90_ms,latency_p99_ms,latency_max_ms,"
+           "wait_mean_N_ms,wait_mean_F_ms,wait_mean_C_ms,wait_p99_ms,wait_max_ms,switches,ferry_departures,ferry_fill\n");
+    for (size_t i = 0; i < rows.size(); ++i) {
+        const Row &r = rows[i];
+        printf("%zu", i);
+        for (int value : Configuration(parameters, i)) printf(",%d", value);
+        printf(",%llu,%llu,%llu,%.1f,%.0f,%.0f,%.0f,%.0f,%.1f,%.1f,%.1f,%.0f,%.0f,%llu,%llu,%.3f\n", r.cars, r.events,
+               r.makespan, r.latencyMean, r.latencyP50, r.latencyP90, r.latencyP99, r.latencyMax, r.waitMean[0],
+               r.waitMean[1], r.waitMean[2], r.waitP99, r.waitMax, r.switches, r.departures, r.fill);
+    }
+}
+
+static void PrintJson(const std::vector<Parameter> &parameters, const std::vector<Row> &rows) {
+    printf("[\n");
+    for (size_t i = 0; i < rows.size(); ++i) {
+        const Row &r = rows[i];
+        std::vector<int> values = Configuration(parameters, i);
+        printf("  {\"run\": %zu, \"parameters\": {", i);
+        for (size_t p = 0; p < parameters.size(); ++p) {
+            printf("%s\"%s\": %d", p == 0 ? "" : ", ", parameters[p].name.c_str(), values[p]);
+        }
+        printf("}, \"cars\": %llu, \"events\": %llu, \"makespan_ms\": %llu,"
+               " \"latency_ms\": {\"mean\": %.1f, \"p50\": %.0f, \"p90\": %.0f, \"p99\": %.0f, \"max\": %.0f},"
+               " \"wait_ms\": {\"mean_N\": %.1f, \"mean_F\": %.1f, \"mean_C\": %.1f, \"p99\": %.0f, \"max\": %.0f},"
+               " \"switches\": %llu, \"ferry_departures\": %llu, \"ferry_fill\": %.3f}%s\n",
+               r.cars, r.events, r.makespan, r.latencyMean, r.latencyP50, r.latencyP90, r.latencyP99, r.latencyMax,
+               r.waitMean[0], r.waitMean[1], r.waitMean[2], r.waitP99, r.waitMax, r.switches, r.departures, r.fill,
+               i + 1 < rows.size() ? "," : "");
+    }
+    printf("]\n");
+}
+
+int main(int argc, char *argv[]) {
+    int jobs = std::thread::hardware_concurrency();
+    bool json = false;
+    const char *input = nullptr;
+    std::vector<Parameter> parameters;
+    for (int i = 1; i < argc; ++i) {
+        Parameter parameter;
+        if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+            jobs = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc &&
+                   (strcmp(argv[i + 1], "csv") == 0 || strcmp(argv[i + 1], "json") == 0)) {
+            json = strcmp(argv[++i], "json") == 0;
+        } else if (strcmp(argv[i], "--param") == 0 && i + 1 < argc && ParseParameter(argv[i + 1], parameter)) {
+            parameters.push_back(parameter);
+            i++;
+        } else if (argv[i][0] != '-' && input == nullptr) {
+            input = argv[i];
+        } else {
+            fprintf(stderr, "Usage: %s [--jobs N] [--format csv|json] --param NAME=VALUES [--param ...] [scenario]\n"
+                            "NAME is N, F or C with an optional id, then .travel, .maxWait or .capacity, or car.travel.\n"
+                            "VALUES is a list 10,20,50 or a range START:END:STEP.\n", argv[0]);
+            return 1;
+        }
+    }
+
+    int fd = input != nullptr ? open(input, O_RDONLY) : STDIN_FILENO;
+    if (fd < 0) {
+        perror(input);
+        return 1;
+    }
+    Scenario base;
+    if (!LoadScenario(fd, base)) {
+        fprintf(stderr, "Invalid input.\n");
+        return 1;
+    }
+    if (input != nullptr) close(fd);
+
+    size_t runs = 1;
+    for (const Parameter &parameter : parameters) {
+        size_t count = parameter.type == 'N' ? base.narrowBridges.size()
+                     : parameter.type == 'F' ? base.ferries.size() : base.crossroads.size();
+        if (parameter.type != 'c' && parameter.id >= 0 && (size_t)parameter.id >= count) {
+            fprintf(stderr, "%s: the scenario has no such connector.\n", parameter.name.c_str());
+            return 1;
+        }
+        runs *= parameter.values.size();
+    }
+
+    std::vector<Row> rows(runs);
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> workers;
+    for (int w = 0; w < std::max(1, jobs); ++w) {
+        workers.emplace_back([&] {
+            for (size_t run; (run = next.fetch_add(1)) < runs;) {
+                Scenario scenario = base;
+                std::vector<int> values = Configuration(parameters, run);
+                for (size_t p = 0; p < parameters.size(); ++p) Apply(parameters[p], values[p], scenario);
+                VirtualSummary summary;
+                SummarizeVirtual(scenario, summary);
+                rows[run] = Summarize(summary, scenario.cars.size());
+            }
+        });
+    }
+    for (std::thread &worker : workers) worker.join();
+
+    if (json) PrintJson(parameters, rows);
+    else PrintCsv(parameters, rows);
+    return 0;
+}
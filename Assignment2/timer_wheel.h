@@ -0,0 +1,250 @@
+#ifndef HOMEWORK2_TIMER_WHEEL_H
+#define HOMEWORK2_TIMER_WHEEL_H
+
+#include <pthread.h>
+#include <time.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include "monitor.h"
+
+#define TIMER_TICK_NS 1000000ULL // One wheel slot per millisecond
+#define TIMER_LEVEL_BITS 6
+#define TIMER_LEVEL_SLOTS (1 << TIMER_LEVEL_BITS)
+#define TIMER_LEVELS 4 // 64^4 ms, a bit over 4.6 hours, later deadlines wait in the last level
+
+// Independent wheels, each with its own lock and thread
+#ifndef TIMER_WHEEL_SHARDS
+#define TIMER_WHEEL_SHARDS 8
+#endif
+
+//! Hierarchical timer wheel with a timer thread. There are TIMER_WHEEL_SHARDS of them and
+//! every connector keeps to the one Pick gave it, so connectors on different shards never
+//! meet on a wheel lock. Connectors embed a Timer for each deadline they track and Arm it,
+//! the thread calls the callback once the deadline has passed. Arming, cancelling and firing
+//! a timer are O(1), a timer in a higher level is moved down a level at most once per level.
+//! Callbacks run outside the wheel lock, so they may take the connector lock while connectors
+//! arm timers with theirs held. A callback can still be running when its timer is re-armed
+//! or disarmed, so it has to check the deadline it stands for.
+class TimerWheel : public Monitor {
+public:
+    struct Timer {
+        Timer *next;
+        Timer **prev; // The pointer that points at this timer, nullptr while it is not armed
+        unsigned long long expires; // In ticks
+        void (*callback)(void *owner, int arg);
+        void *owner;
+        int arg;
+        bool fired; // Expired and waiting in pending for its callback
+
+        Timer(void (*callback)(void*, int), void *owner, int arg)
+            : next(nullptr), prev(nullptr), expires(0), callback(callback), owner(owner), arg(arg), fired(false) {}
+        Timer(const Timer&) = delete;
+        Timer& operator=(const Timer&) = delete;
+    };
+
+private:
+    Timer *slots[TIMER_LEVELS][TIMER_LEVEL_SLOTS];
+    unsigned long long current; // Every tick up to this one has been handled
+    unsigned long long wakeTick; // When the thread wakes up next, it is told about earlier timers
+    int armed; // Timers in the slots
+    std::vector<Timer*> pending; // Expired timers whose callbacks have not run, nullptr once dropped
+    Timer *running; // The timer whose callback runs right now
+    Condition changed;
+    Condition finished; // A callback returned
+    pthread_t thread;
+
+    static unsigned long long nowTick() {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return ((unsigned long long)now.tv_sec * 1000000000ULL + now.tv_nsec) / TIMER_TICK_NS;
+    }
+
+    // First tick at or after the deadline, so a timer never fires early
+    static unsigned long long deadlineTick(const struct timespec *deadline) {
+        unsigned long long ns = (unsigned long long)deadline->tv_sec * 1000000000ULL + deadline->tv_nsec;
+        return (ns + TIMER_TICK_NS - 1) / TIMER_TICK_NS;
+    }
+
+    // earliest is the first tick that has not been handled yet
+    void link(Timer *timer, unsigned long long earliest) {
+        unsigned long long expires = timer->expires > earliest ? timer->expires : earliest;
+        unsigned long long delta = expires - current;
+        int level = 0;
+        while (level < TIMER_LEVELS - 1 && delta >= (1ULL << (TIMER_LEVEL_BITS * (level + 1)))) {
+            level++;
+        }
+        if (delta >= (1ULL << (TIMER_LEVEL_BITS * TIMER_LEVELS))) {
+            expires = current + (1ULL << (TIMER_LEVEL_BITS * TIMER_LEVELS)) - 1; // Comes back around
+        }
+        Timer **slot = &slots[level][(expires >> (TIMER_LEVEL_BITS * level)) & (TIMER_LEVEL_SLOTS - 1)];
+        timer->next = *slot;
+        if (timer->next) timer->next->prev = &timer->next;
+        timer->prev = slot;
+        *slot = timer;
+    }
+
+    void unlink(Timer *timer) {
+        *timer->prev = timer->next;
+        if (timer->next) timer->next->prev = timer->prev;
+        timer->next = nullptr;
+        timer->prev = nullptr;
+    }
+
+    // Moves the timers of a higher level slot down to where they belong now
+    void cascade(int level) {
+        int index = (current >> (TIMER_LEVEL_BITS * level)) & (TIMER_LEVEL_SLOTS - 1);
+        Timer *timer = slots[level][index];
+        slots[level][index] = nullptr;
+        while (timer) {
+            Timer *next = timer->next;
+            link(timer, current); // The slot of this tick is handled right after the cascade
+            timer = next;
+        }
+    }
+
+    // Handles the ticks up to now, expired timers are unlinked and queued for their callbacks
+    void advance(unsigned long long now) {
+        while (current < now) {
+            current++;
+            for (int level = 1; level < TIMER_LEVELS; ++level) {
+                if ((current & ((1ULL << (TIMER_LEVEL_BITS * level)) - 1)) != 0) break;
+                cascade(level);
+            }
+            Timer **slot = &slots[0][current & (TIMER_LEVEL_SLOTS - 1)];
+            while (*slot) {
+                Timer *timer = *slot;
+                unlink(timer);
+                armed--;
+                timer->fired = true;
+                pending.push_back(timer);
+            }
+        }
+    }
+
+    // The next tick with a level 0 timer, or the next cascade, whichever comes first
+    unsigned long long nextTick() const {
+        unsigned long long boundary = (current | (TIMER_LEVEL_SLOTS - 1)) + 1;
+        for (unsigned long long tick = current + 1; tick < boundary; ++tick) {
+            if (slots[0][tick & (TIMER_LEVEL_SLOTS - 1)]) return tick;
+        }
+        return boundary;
+    }
+
+    // Drops the callback of an expired timer that has not run yet
+    void drop(Timer *timer) {
+        if (!timer->fired) return;
+        timer->fired = false;
+        for (Timer *&queued : pending) {
+            if (queued == timer) queued = nullptr;
+        }
+    }
+
+    void run() {
+        __synchronized__;
+        while (true) {
+            if (armed == 0) {
+                wakeTick = ~0ULL;
+                changed.wait();
+                continue;
+            }
+            advance(nowTick());
+            if (!pending.empty()) {
+                // One at a time, Disarm and Cancel may drop the callbacks that have not run
+                for (size_t i = 0; i < pending.size(); ++i) {
+                    Timer *timer = pending[i];
+                    if (timer == nullptr) continue;
+                    timer->fired = false;
+                    running = timer;
+                    void (*callback)(void*, int) = timer->callback;
+                    void *owner = timer->owner;
+                    int arg = timer->arg;
+                    mutex.unlock();
+                    callback(owner, arg);
+                    mutex.lock();
+                    running = nullptr;
+                    finished.notifyAll();
+                }
+                pending.clear();
+                continue; // Callbacks take time and usually arm new timers
+            }
+            if (armed == 0) continue;
+            wakeTick = nextTick();
+            struct timespec until;
+            unsigned long long ns = wakeTick * TIMER_TICK_NS;
+            until.tv_sec = ns / 1000000000ULL;
+            until.tv_nsec = ns % 1000000000ULL;
+            changed.timedwait(&until);
+        }
+    }
+
+    static void *threadFunction(void *arg) {
+        ((TimerWheel*)arg)->run();
+        return nullptr;
+    }
+
+    TimerWheel() : slots(), current(nowTick()), wakeTick(~0ULL), armed(0), running(nullptr), changed(this), finished(this) {
+        profileAs("TimerWheel");
+        pthread_create(&thread, nullptr, threadFunction, this);
+    }
+
+public:
+    //! The wheel of shard index % TIMER_WHEEL_SHARDS, its thread starts with the first use
+    //! and runs until exit
+    static TimerWheel& Shard(unsigned index) {
+        static TimerWheel *wheels[TIMER_WHEEL_SHARDS]; // Never destroyed, connectors may outlive statics
+        static std::once_flag created[TIMER_WHEEL_SHARDS];
+        index %= TIMER_WHEEL_SHARDS;
+        std::call_once(created[index], [index] { wheels[index] = new TimerWheel(); });
+        return *wheels[index];
+    }
+
+    //! A wheel for a new connector, connectors are dealt to the shards in turn
+    static TimerWheel& Pick() {
+        static std::atomic<unsigned> next(0);
+        return Shard(next.fetch_add(1, std::memory_order_relaxed));
+    }
+
+    //! Fires the timer once the CLOCK_MONOTONIC deadline has passed, an armed timer is moved
+    void Arm(Timer *timer, const struct timespec *deadline) {
+        __synchronized__;
+        if (timer->prev) {
+            unlink(timer);
+        } else {
+            drop(timer); // The new deadline replaces one that has just expired
+            if (armed++ == 0) current = nowTick(); // Nothing to cascade while the wheel is empty
+        }
+        timer->expires = deadlineTick(deadline);
+        link(timer, current + 1);
+        if (timer->expires < wakeTick) {
+            changed.notify();
+        }
+    }
+
+    //! Takes the timer out of the wheel, a callback of it that is running still finishes.
+    //! For callers that hold the lock the callback takes.
+    void Disarm(Timer *timer) {
+        __synchronized__;
+        if (timer->prev) {
+            unlink(timer);
+            armed--;
+        }
+        drop(timer);
+    }
+
+    //! Takes the timer out of the wheel and returns once no callback of it is running, so
+    //! the owner can be destroyed. Must not be called with a lock the callback takes.
+    void Cancel(Timer *timer) {
+        __synchronized__;
+        if (timer->prev) {
+            unlink(timer);
+            armed--;
+        }
+        drop(timer);
+        while (running == timer) {
+            finished.wait();
+        }
+    }
+};
+
+#endif //HOMEWORK2_TIMER_WHEEL_H
@@ -0,0 +1,129 @@
+// Converts a binary trace written with --binary-trace back to the text format.
+// Usage: trace_convert [--verbose] [--precision ms|us|ns] [--from T] [--to T] [--info] trace
+// --from and --to select the records with from <= time < to, in the printed unit
+// (milliseconds unless --precision says otherwise). If the header says the trace is in time
+// order, as threaded runs are, the start is found with a binary search and the output stops
+// at the first record past the end, so skipping into a long trace is cheap. Otherwise every
+// record is read and filtered by its time.
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "WriteOutput.h"
+
+#define TRACE_CONVERT_BUFFER_SIZE (1024 * 1024)
+
+static void WriteAll(const char *buffer, size_t size) {
+    while (size > 0) {
+        ssize_t n = write(STDOUT_FILENO, buffer, size);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("write");
+            exit(1);
+        }
+        buffer += n;
+        size -= n;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    unsigned long long from = 0, to = ~0ULL, unit = 1000000;
+    bool info = false;
+    const char *path = nullptr;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--verbose") == 0) {
+            SetOutputMode(OUTPUT_VERBOSE);
+        } else if (strcmp(argv[i], "--precision") == 0 && i + 1 < argc) {
+            ++i;
+            unit = strcmp(argv[i], "ns") == 0 ? 1 : strcmp(argv[i], "us") == 0 ? 1000 : 1000000;
+            SetTimestampUnit(unit);
+        } else if (strcmp(argv[i], "--from") == 0 && i + 1 < argc) {
+            from = strtoull(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--to") == 0 && i + 1 < argc) {
+            to = strtoull(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--info") == 0) {
+            info = true;
+        } else if (path == nullptr && argv[i][0] != '-') {
+            path = argv[i];
+        } else {
+            path = nullptr;
+            break;
+        }
+    }
+    if (path == nullptr) {
+        fprintf(stderr, "Usage: %s [--verbose] [--precision ms|us|ns] [--from T] [--to T] [--info] trace\n", argv[0]);
+        return 1;
+    }
+
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        perror(path);
+        return 1;
+    }
+    if (st.st_size < TRACE_HEADER_SIZE) {
+        fprintf(stderr, "%s: not a trace\n", path);
+        return 1;
+    }
+    void *mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapped == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+    madvise(mapped, st.st_size, MADV_SEQUENTIAL);
+
+    const TraceHeader *header = (const TraceHeader*)mapped;
+    if (memcmp(header->magic, TRACE_MAGIC, sizeof(header->magic)) != 0 || header->version != TRACE_VERSION
+        || header->recordSize != sizeof(TraceRecord)) {
+        fprintf(stderr, "%s: not a version %d trace\n", path, TRACE_VERSION);
+        return 1;
+    }
+    const TraceRecord *records = (const TraceRecord*)((const char*)mapped + TRACE_HEADER_SIZE);
+    unsigned long long count = (st.st_size - TRACE_HEADER_SIZE) / sizeof(TraceRecord);
+    if (header->recordCount != 0 && header->recordCount < count) count = header->recordCount;
+
+    if (info) {
+        printf("narrow bridges: %u\nferries: %u\ncrossroads: %u\ncars: %u\nrecords: %llu%s\n",
+               header->narrowBridges, header->ferries, header->crossroads, header->cars, count,
+               header->recordCount == 0 ? " (not closed)" : "");
+        if (count > 0) {
+            unsigned long long first = records[0].time, last = records[count - 1].time;
+            for (unsigned long long i = 0; !header->ordered && i < count; ++i) {
+                first = std::min(first, records[i].time);
+                last = std::max(last, records[i].time);
+            }
+            printf("time: %llu - %llu ns%s\n", first, last, header->ordered ? "" : " (not in time order)");
+        }
+        return 0;
+    }
+
+    from *= unit;
+    to = to > ~0ULL / unit ? ~0ULL : to * unit;
+    const TraceRecord *first = records, *end = records + count;
+    if (header->ordered) {
+        first = std::lower_bound(records, end, from,
+            [](const TraceRecord& record, unsigned long long time) { return record.time < time; });
+        end = std::lower_bound(first, end, to,
+            [](const TraceRecord& record, unsigned long long time) { return record.time < time; });
+    }
+    std::vector<char> buffer(TRACE_CONVERT_BUFFER_SIZE);
+    size_t used = 0;
+    for (const TraceRecord *record = first; record < end; ++record) {
+        if (record->time < from || record->time >= to) continue;
+        if (used + WRITE_OUTPUT_LINE_SIZE > buffer.size()) {
+            WriteAll(buffer.data(), used);
+            used = 0;
+        }
+        used += FormatOutputLine(buffer.data() + used, (const unsigned char*)&record->threadID, sizeof(record->threadID),
+                                 record->time, record->carID, record->connectorType, record->connectorID,
+                                 (Action)record->action);
+    }
+    WriteAll(buffer.data(), used);
+    return 0;
+}
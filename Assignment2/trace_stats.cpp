@@ -0,0 +1,517 @@
+// Aggregates a simulator trace: how long every car took end to end and where the time went,
+// how long cars waited at every connector, how busy each connector was, the paths of the
+// slowest cars and the connector that holds cars up the most.
+// Usage: trace_stats [--precision ms|us|ns] [--threads N] [--top K] [--csv PREFIX] trace
+// The trace is a text trace in the grading or verbose format or a binary trace. Tables go to
+// stdout, with --csv the per car and per connector rows also go to PREFIX.cars.csv and
+// PREFIX.connectors.csv. Times are printed in milliseconds.
+// The file is mapped and cut into one chunk per thread at line boundaries. Every thread parses
+// its chunk into buckets by car, then every thread follows the cars of one bucket through all
+// chunks in order, so no car is split between threads. Connector totals are kept per thread
+// and merged at the end.
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "WriteOutput.h"
+
+#define TRACE_STATS_TOP_CONNECTORS 10 // Rows of the connector table, by total wait
+#define TRACE_STATS_MAX_ID (1 << 26) // Larger car or connector ids are taken for garbage
+#define NO_TIME (~0ULL)
+
+struct Event {
+    unsigned long long time; // ns
+    int car;
+    int id;
+    char type;
+    char action;
+};
+
+// Events of one chunk, bucket b has the cars with car % buckets == b in trace order
+struct Chunk {
+    std::vector<std::vector<Event>> buckets;
+    unsigned long long malformed;
+    int maxCar;
+    int maxId[3]; // N, F, C
+    unsigned long long firstTime, lastTime;
+};
+
+// Time from since to now, 0 if the clock went back
+static inline unsigned long long Since(unsigned long long since, unsigned long long now) {
+    return now > since ? now - since : 0;
+}
+
+struct CarResult {
+    unsigned long long start; // First event, NO_TIME if the car did not show up
+    unsigned long long end; // Last FINISH_PASSING
+    unsigned long long travelNs, waitNs, passNs;
+    unsigned int segments;
+};
+
+// One interval a car spent passing a connector
+struct Pass {
+    unsigned long long start, finish;
+};
+
+struct ConnectorStats {
+    std::vector<unsigned long long> waits; // ARRIVE to START_PASSING of every car
+    std::vector<Pass> passes;
+    unsigned long long waitNs;
+};
+
+struct ConnectorRow {
+    char type;
+    int id;
+    unsigned long long cars;
+    double waitMean, waitP50, waitP99, waitMax; // ms
+    double waitTotal; // ms summed over the cars
+    double busy; // ms with at least one car passing
+    double utilization; // busy / span
+    double queue; // Mean number of cars waiting, total wait / span
+};
+
+static const char connectorTypes[] = { 'N', 'F', 'C' };
+
+static int TypeIndex(char type) { return type == 'N' ? 0 : type == 'F' ? 1 : type == 'C' ? 2 : -1; }
+
+static inline bool Number(const char *&p, const char *end, unsigned long long &value) {
+    if (p == end || (unsigned)(*p - '0') > 9) return false;
+    unsigned long long v = 0;
+    while (p < end && (unsigned)(*p - '0') <= 9) v = v * 10 + (*p++ - '0');
+    value = v;
+    return true;
+}
+
+template <size_t N>
+static inline bool Skip(const char *&p, const char *end, const char (&text)[N]) {
+    if ((size_t)(end - p) < N - 1 || memcmp(p, text, N - 1) != 0) return false;
+    p += N - 1;
+    return true;
+}
+
+// "tid car N3 time action" or "ThreadID: tid, CarID: car, Object: N3, time stamp: time, AID: action text"
+static bool ParseLine(const char *p, const char *end, unsigned long long unitNs, Event &e) {
+    unsigned long long car, id, time, action;
+    bool verbose = *p == 'T' && Skip(p, end, "ThreadID: ");
+    p = (const char*)memchr(p, verbose ? ',' : ' ', end - p);
+    if (p == nullptr) return false;
+    if (verbose) {
+        if (!Skip(p, end, ", CarID: ") || !Number(p, end, car) || !Skip(p, end, ", Object: ") || p == end) return false;
+        e.type = *p++;
+        if (!Number(p, end, id) || !Skip(p, end, ", time stamp: ") || !Number(p, end, time) ||
+            !Skip(p, end, ", AID: ") || !Number(p, end, action)) {
+            return false;
+        }
+    } else {
+        if (!Skip(p, end, " ") || !Number(p, end, car) || !Skip(p, end, " ") || p == end) return false;
+        e.type = *p++;
+        if (!Number(p, end, id) || !Skip(p, end, " ") || !Number(p, end, time) || !Skip(p, end, " ") ||
+            !Number(p, end, action)) {
+            return false;
+        }
+    }
+    if (car > TRACE_STATS_MAX_ID || id > TRACE_STATS_MAX_ID || action > FINISH_PASSING || TypeIndex(e.type) < 0) {
+        return false;
+    }
+    e.car = car;
+    e.id = id;
+    e.time = time * unitNs;
+    e.action = action;
+    return true;
+}
+
+static void Add(Chunk &chunk, const Event &e) {
+    chunk.buckets[e.car % chunk.buckets.size()].push_back(e);
+    chunk.maxCar = std::max(chunk.maxCar, e.car);
+    int &maxId = chunk.maxId[TypeIndex(e.type)];
+    maxId = std::max(maxId, e.id);
+    chunk.firstTime = std::min(chunk.firstTime, e.time);
+    chunk.lastTime = std::max(chunk.lastTime, e.time);
+}
+
+static void ParseText(const char *p, const char *end, unsigned long long unitNs, Chunk &chunk) {
+    while (p < end) {
+        const char *newline = (const char*)memchr(p, '\n', end - p);
+        const char *lineEnd = newline != nullptr ? newline : end;
+        const char *last = lineEnd > p && lineEnd[-1] == '\r' ? lineEnd - 1 : lineEnd;
+        Event e;
+        if (last > p) {
+            if (ParseLine(p, last, unitNs, e)) Add(chunk, e);
+            else chunk.malformed++;
+        }
+        p = lineEnd + 1;
+    }
+}
+
+static void ParseBinary(const TraceRecord *record, const TraceRecord *end, Chunk &chunk) {
+    for (; record < end; ++record) {
+        Event e = { record->time, record->carID, record->connectorID, record->connectorType, record->action };
+        if (e.car >= 0 && e.car <= TRACE_STATS_MAX_ID && e.id >= 0 && e.id <= TRACE_STATS_MAX_ID &&
+            e.action >= TRAVEL && e.action <= FINISH_PASSING && TypeIndex(e.type) >= 0) {
+            Add(chunk, e);
+        } else {
+            chunk.malformed++;
+        }
+    }
+}
+
+//! Follows the cars of one bucket through the chunks. A car's events are in program order
+//! in the trace, since the thread of the car wrote them, so it is a small state machine.
+class CarWalker {
+    std::vector<CarResult> &cars;
+    std::vector<ConnectorStats> &connectors; // Of this thread
+    const int *firstConnector;
+    std::vector<unsigned long long> segmentStart; // Last FINISH_PASSING or the first TRAVEL
+    std::vector<unsigned long long> arrived;
+    std::vector<unsigned long long> started;
+    std::vector<char> expected;
+
+public:
+    CarWalker(std::vector<CarResult> &c, std::vector<ConnectorStats> &s, const int *first)
+        : cars(c), connectors(s), firstConnector(first) {}
+
+    void Walk(const std::vector<Chunk> &chunks, size_t bucket) {
+        size_t owned = (cars.size() + chunks[0].buckets.size() - 1 - bucket) / chunks[0].buckets.size();
+        segmentStart.assign(owned, NO_TIME);
+        arrived.assign(owned, NO_TIME);
+        started.assign(owned, NO_TIME);
+        expected.assign(owned, TRAVEL);
+        for (const Chunk &chunk : chunks) {
+            for (const Event &e : chunk.buckets[bucket]) Step(e, e.car / chunks[0].buckets.size());
+        }
+    }
+
+private:
+    void Step(const Event &e, size_t slot) {
+        CarResult &car = cars[e.car];
+        ConnectorStats &connector = connectors[firstConnector[TypeIndex(e.type)] + e.id];
+        if (car.start == NO_TIME) car.start = e.time;
+        if (e.action != expected[slot]) {
+            // Events are missing, go on from this one without the segment that was cut
+            segmentStart[slot] = arrived[slot] = started[slot] = NO_TIME;
+        }
+        expected[slot] = (e.action + 1) % 4;
+        switch (e.action) {
+        case TRAVEL:
+            if (segmentStart[slot] == NO_TIME) segmentStart[slot] = e.time;
+            break;
+        case ARRIVE:
+            arrived[slot] = e.time;
+            if (segmentStart[slot] != NO_TIME) car.travelNs += Since(segmentStart[slot], e.time);
+            break;
+        case START_PASSING:
+            started[slot] = e.time;
+            if (arrived[slot] != NO_TIME) {
+                unsigned long long wait = Since(arrived[slot], e.time);
+                car.waitNs += wait;
+                connector.waits.push_back(wait);
+                connector.waitNs += wait;
+            }
+            break;
+        default:
+            if (started[slot] != NO_TIME) {
+                car.passNs += Since(started[slot], e.time);
+                connector.passes.push_back({ std::min(started[slot], e.time), e.time });
+            }
+            car.end = e.time;
+            car.segments++;
+            segmentStart[slot] = e.time;
+            arrived[slot] = started[slot] = NO_TIME;
+            break;
+        }
+    }
+};
+
+static double Percentile(std::vector<unsigned long long> &values, double p) {
+    if (values.empty()) return 0;
+    size_t k = std::min(values.size() - 1, (size_t)(p / 100 * values.size()));
+    std::nth_element(values.begin(), values.begin() + k, values.end());
+    return values[k];
+}
+
+// Length of the union of the intervals, sorts them
+static unsigned long long BusyNs(std::vector<Pass> &passes) {
+    std::sort(passes.begin(), passes.end(), [](const Pass &a, const Pass &b) { return a.start < b.start; });
+    unsigned long long busy = 0, start = 0, finish = 0;
+    bool open = false;
+    for (const Pass &pass : passes) {
+        if (open && pass.start <= finish) {
+            finish = std::max(finish, pass.finish);
+            continue;
+        }
+        if (open) busy += finish - start;
+        start = pass.start;
+        finish = pass.finish;
+        open = true;
+    }
+    if (open) busy += finish - start;
+    return busy;
+}
+
+static void ParallelFor(size_t count, int threads, auto body) {
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t] {
+            for (size_t i = t; i < count; i += threads) body(i);
+        });
+    }
+    for (std::thread &worker : workers) worker.join();
+}
+
+// Segments of one car with the times spent on each, for the slowest cars table
+static void PrintPath(const std::vector<Chunk> &chunks, int car) {
+    size_t bucket = car % chunks[0].buckets.size();
+    unsigned long long segmentStart = NO_TIME, arrived = NO_TIME, started = NO_TIME;
+    for (const Chunk &chunk : chunks) {
+        for (const Event &e : chunk.buckets[bucket]) {
+            if (e.car != car) continue;
+            if (e.action == TRAVEL && segmentStart == NO_TIME) segmentStart = e.time;
+            else if (e.action == ARRIVE) arrived = e.time;
+            else if (e.action == START_PASSING) started = e.time;
+            else if (e.action == FINISH_PASSING) {
+                if (segmentStart != NO_TIME && arrived != NO_TIME && started != NO_TIME) {
+                    printf("    %c%-6d travel %10.3f  wait %10.3f  pass %10.3f\n", e.type, e.id,
+                           Since(segmentStart, arrived) / 1e6, Since(arrived, started) / 1e6, Since(started, e.time) / 1e6);
+                }
+                segmentStart = e.time;
+                arrived = started = NO_TIME;
+            }
+        }
+    }
+}
+
+static bool WriteCsv(const std::string &prefix, const std::vector<CarResult> &cars,
+                     const std::vector<ConnectorRow> &rows) {
+    FILE *file = fopen((prefix + ".cars.csv").c_str(), "w");
+    if (file == NULL) return false;
+    fprintf(file, "car,start_ms,end_ms,latency_ms,travel_ms,wait_ms,pass_ms,segments\n");
+    for (size_t c = 0; c < cars.size(); ++c) {
+        const CarResult &car = cars[c];
+        if (car.start == NO_TIME) continue;
+        fprintf(file, "%zu,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%u\n", c, car.start / 1e6, car.end / 1e6,
+                Since(car.start, car.end) / 1e6, car.travelNs / 1e6, car.waitNs / 1e6, car.passNs / 1e6,
+                car.segments);
+    }
+    if (fclose(file) != 0) return false;
+
+    file = fopen((prefix + ".connectors.csv").c_str(), "w");
+    if (file == NULL) return false;
+    fprintf(file, "connector,cars,wait_mean_ms,wait_p50_ms,wait_p99_ms,wait_max_ms,wait_total_ms,busy_ms,"
+                  "utilization,mean_queue\n");
+    for (const ConnectorRow &r : rows) {
+        fprintf(file, "%c%d,%llu,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.4f,%.4f\n", r.type, r.id, r.cars, r.waitMean,
+                r.waitP50, r.waitP99, r.waitMax, r.waitTotal, r.busy, r.utilization, r.queue);
+    }
+    return fclose(file) == 0;
+}
+
+int main(int argc, char *argv[]) {
+    unsigned long long unitNs = 1000000;
+    int threads = std::max(1u, std::thread::hardware_concurrency()), top = 5;
+    const char *path = nullptr, *csv = nullptr;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--precision") == 0 && i + 1 < argc) {
+            ++i;
+            unitNs = strcmp(argv[i], "ns") == 0 ? 1 : strcmp(argv[i], "us") == 0 ? 1000 : 1000000;
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = std::max(1, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--top") == 0 && i + 1 < argc) {
+            top = std::max(0, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--csv") == 0 && i + 1 < argc) {
+            csv = argv[++i];
+        } else if (path == nullptr && argv[i][0] != '-') {
+            path = argv[i];
+        } else {
+            path = nullptr;
+            break;
+        }
+    }
+    if (path == nullptr) {
+        fprintf(stderr, "Usage: %s [--precision ms|us|ns] [--threads N] [--top K] [--csv PREFIX] trace\n", argv[0]);
+        return 1;
+    }
+
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        perror(path);
+        return 1;
+    }
+    if (st.st_size == 0) {
+        fprintf(stderr, "%s: empty trace\n", path);
+        return 1;
+    }
+    void *mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapped == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+    const char *data = (const char*)mapped, *dataEnd = data + st.st_size;
+    auto begin = std::chrono::steady_clock::now();
+
+    // Parse, chunk t covers [bounds[t], bounds[t + 1])
+    std::vector<Chunk> chunks(threads);
+    for (Chunk &chunk : chunks) {
+        chunk.buckets.resize(threads);
+        chunk.malformed = 0;
+        chunk.maxCar = -1;
+        chunk.maxId[0] = chunk.maxId[1] = chunk.maxId[2] = -1;
+        chunk.firstTime = NO_TIME;
+        chunk.lastTime = 0;
+    }
+    bool binary = st.st_size >= 8 && memcmp(data, TRACE_MAGIC, 8) == 0;
+    if (binary) {
+        const TraceHeader *header = (const TraceHeader*)data;
+        if (st.st_size < TRACE_HEADER_SIZE || header->version != TRACE_VERSION || header->recordSize != sizeof(TraceRecord)) {
+            fprintf(stderr, "%s: not a version %d trace\n", path, TRACE_VERSION);
+            return 1;
+        }
+        const TraceRecord *records = (const TraceRecord*)(data + TRACE_HEADER_SIZE);
+        size_t count = (st.st_size - TRACE_HEADER_SIZE) / sizeof(TraceRecord);
+        if (header->recordCount != 0 && header->recordCount < count) count = header->recordCount;
+        ParallelFor(threads, threads, [&](size_t t) {
+            ParseBinary(records + count * t / threads, records + count * (t + 1) / threads, chunks[t]);
+        });
+    } else {
+        madvise(mapped, st.st_size, MADV_SEQUENTIAL);
+        std::vector<const char*> bounds(threads + 1, dataEnd);
+        bounds[0] = data;
+        for (int t = 1; t < threads; ++t) {
+            const char *at = std::max(bounds[t - 1], data + st.st_size * t / threads);
+            const char *newline = at > data ? (const char*)memchr(at - 1, '\n', dataEnd - at + 1) : at;
+            bounds[t] = newline != nullptr ? std::max(at, newline + 1) : dataEnd;
+        }
+        ParallelFor(threads, threads, [&](size_t t) { ParseText(bounds[t], bounds[t + 1], unitNs, chunks[t]); });
+    }
+    auto parsed = std::chrono::steady_clock::now();
+
+    int maxCar = -1, maxId[3] = { -1, -1, -1 };
+    unsigned long long events = 0, malformed = 0, spanStart = NO_TIME, spanEnd = 0;
+    for (const Chunk &chunk : chunks) {
+        maxCar = std::max(maxCar, chunk.maxCar);
+        for (int t = 0; t < 3; ++t) maxId[t] = std::max(maxId[t], chunk.maxId[t]);
+        malformed += chunk.malformed;
+        for (const std::vector<Event> &bucket : chunk.buckets) events += bucket.size();
+        spanStart = std::min(spanStart, chunk.firstTime);
+        spanEnd = std::max(spanEnd, chunk.lastTime);
+    }
+    if (events == 0) {
+        fprintf(stderr, "%s: no events\n", path);
+        return 1;
+    }
+    int firstConnector[3] = { 0, maxId[0] + 1, maxId[0] + 1 + maxId[1] + 1 };
+    size_t connectorCount = firstConnector[2] + maxId[2] + 1;
+
+    // Follow the cars, bucket by bucket
+    std::vector<CarResult> cars(maxCar + 1, CarResult{ NO_TIME, 0, 0, 0, 0, 0 });
+    std::vector<std::vector<ConnectorStats>> perThread(threads, std::vector<ConnectorStats>(connectorCount));
+    ParallelFor(threads, threads, [&](size_t b) { CarWalker(cars, perThread[b], firstConnector).Walk(chunks, b); });
+
+    // Merge the connectors
+    double span = spanEnd > spanStart ? spanEnd - spanStart : 1;
+    std::vector<ConnectorRow> rows(connectorCount);
+    ParallelFor(connectorCount, threads, [&](size_t c) {
+        ConnectorStats all = {};
+        for (std::vector<ConnectorStats> &stats : perThread) {
+            all.waits.insert(all.waits.end(), stats[c].waits.begin(), stats[c].waits.end());
+            all.passes.insert(all.passes.end(), stats[c].passes.begin(), stats[c].passes.end());
+            all.waitNs += stats[c].waitNs;
+            stats[c] = {};
+        }
+        ConnectorRow &r = rows[c];
+        int type = c >= (size_t)firstConnector[2] ? 2 : c >= (size_t)firstConnector[1] ? 1 : 0;
+        r.type = connectorTypes[type];
+        r.id = c - firstConnector[type];
+        r.cars = all.waits.size();
+        r.waitMean = r.cars > 0 ? all.waitNs / 1e6 / r.cars : 0;
+        r.waitP50 = Percentile(all.waits, 50) / 1e6;
+        r.waitP99 = Percentile(all.waits, 99) / 1e6;
+        r.waitMax = Percentile(all.waits, 100) / 1e6;
+        r.waitTotal = all.waitNs / 1e6;
+        unsigned long long busy = BusyNs(all.passes);
+        r.busy = busy / 1e6;
+        r.utilization = busy / span;
+        r.queue = all.waitNs / span;
+    });
+    auto analyzed = std::chrono::steady_clock::now();
+
+    // Cars
+    std::vector<unsigned long long> latencies;
+    unsigned long long travelNs = 0, waitNs = 0, passNs = 0, carsSeen = 0;
+    std::vector<std::pair<unsigned long long, int>> slowest;
+    for (size_t c = 0; c < cars.size(); ++c) {
+        const CarResult &car = cars[c];
+        if (car.start == NO_TIME) continue;
+        carsSeen++;
+        unsigned long long latency = Since(car.start, car.end);
+        latencies.push_back(latency);
+        travelNs += car.travelNs;
+        waitNs += car.waitNs;
+        passNs += car.passNs;
+        slowest.push_back({ latency, (int)c });
+    }
+    size_t shown = std::min<size_t>(top, slowest.size());
+    std::partial_sort(slowest.begin(), slowest.begin() + shown, slowest.end(),
+                      [](const auto &a, const auto &b) { return a.first != b.first ? a.first > b.first : a.second < b.second; });
+
+    printf("%s: %llu events of %llu cars over %.3f ms", path, events, carsSeen, (spanEnd - spanStart) / 1e6);
+    if (malformed > 0) printf(", %llu %s skipped", malformed, binary ? "records" : "lines");
+    printf("\n\n");
+    double mean = 0;
+    for (unsigned long long latency : latencies) mean += latency;
+    mean = latencies.empty() ? 0 : mean / latencies.size();
+    printf("Car latency ms: mean %.3f, p50 %.3f, p90 %.3f, p99 %.3f, max %.3f\n", mean / 1e6,
+           Percentile(latencies, 50) / 1e6, Percentile(latencies, 90) / 1e6, Percentile(latencies, 99) / 1e6,
+           Percentile(latencies, 100) / 1e6);
+    double total = travelNs + waitNs + passNs > 0 ? travelNs + waitNs + passNs : 1;
+    printf("Time of the cars: %.1f%% traveling, %.1f%% waiting, %.1f%% passing\n\n", 100 * travelNs / total,
+           100 * waitNs / total, 100 * passNs / total);
+
+    std::vector<const ConnectorRow*> byWait;
+    for (const ConnectorRow &r : rows) {
+        if (r.cars > 0) byWait.push_back(&r);
+    }
+    std::sort(byWait.begin(), byWait.end(), [](const ConnectorRow *a, const ConnectorRow *b) {
+        return a->waitTotal != b->waitTotal ? a->waitTotal > b->waitTotal : a->utilization > b->utilization;
+    });
+    printf("Connectors by total wait\n%-10s %9s %11s %11s %11s %13s %8s %8s\n", "connector", "cars", "wait mean",
+           "wait p99", "wait max", "wait total s", "busy %", "queue");
+    for (size_t i = 0; i < byWait.size() && i < TRACE_STATS_TOP_CONNECTORS; ++i) {
+        const ConnectorRow &r = *byWait[i];
+        char name[16];
+        snprintf(name, sizeof(name), "%c%d", r.type, r.id);
+        printf("%-10s %9llu %11.3f %11.3f %11.3f %13.3f %7.1f%% %8.3f\n", name, r.cars, r.waitMean, r.waitP99, r.waitMax,
+               r.waitTotal / 1000, 100 * r.utilization, r.queue);
+    }
+    if (byWait.size() > TRACE_STATS_TOP_CONNECTORS) printf("... %zu more\n", byWait.size() - TRACE_STATS_TOP_CONNECTORS);
+    if (!byWait.empty() && waitNs > 0) {
+        const ConnectorRow &b = *byWait[0];
+        printf("\nBottleneck: %c%d, %.1f%% of all waiting is there, busy %.1f%% of the time, %.3f cars in line on"
+               " average\n", b.type, b.id, 100 * b.waitTotal * 1e6 / waitNs, 100 * b.utilization, b.queue);
+    }
+
+    if (shown > 0) printf("\nSlowest cars, ms\n");
+    for (size_t i = 0; i < shown; ++i) {
+        const CarResult &car = cars[slowest[i].second];
+        printf("car %d: %.3f, %u segments, %.3f waiting\n", slowest[i].second, slowest[i].first / 1e6, car.segments,
+               car.waitNs / 1e6);
+        PrintPath(chunks, slowest[i].second);
+    }
+
+    if (csv != nullptr && !WriteCsv(csv, cars, rows)) {
+        perror(csv);
+        return 1;
+    }
+    fprintf(stderr, "%.1f MB, parsed in %.3f s, analyzed in %.3f s with %d threads\n", st.st_size / 1e6,
+            std::chrono::duration<double>(parsed - begin).count(),
+            std::chrono::duration<double>(analyzed - parsed).count(), threads);
+    return 0;
+}
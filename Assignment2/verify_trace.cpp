@@ -0,0 +1,599 @@
+// Checks a simulator trace against the connector rules in one streaming pass.
+// Usage: verify_trace [--scenario FILE] [--precision ms|us|ns] [--tolerance MS] [--max-errors N] [trace]
+// The trace is a text trace in the grading or verbose format, or a binary trace, read from
+// stdin if no file is given. Checked are, for every car, that its events come in the order
+// TRAVEL, ARRIVE, START_PASSING, FINISH_PASSING on one connector after the other, and on
+// narrow bridges and crossroads that a car only enters while the cars already on it go its
+// way and at least PASS_DELAY after the car ahead of it. With --scenario the cars also have
+// to follow their paths to the end and take at least their travel times, bridges and
+// crossroads know the directions, and every ferry departure has to be full or have waited
+// maxWaitTime, without taking a car ahead of a full load. Without it those direction and
+// ferry checks are skipped, and a warning on stderr says how many events they missed.
+// Memory is bounded by the number of cars and connectors, not by the trace length. Lines are
+// split 64 bytes at a time with SSE2 compares, and the cars of the next events are prefetched
+// while earlier ones are checked. Violations go to stdout with their line (or record)
+// number, the exit status is 1 if there were any.
+#include <algorithm>
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "WriteOutput.h"
+#include "helper.h"
+#include "scenario.h"
+
+#define VERIFY_BUFFER_SIZE (4 << 20) // Bytes read at a time, a line must fit into it
+#define VERIFY_MAX_ID (1 << 26) // Larger car or connector ids are taken for garbage
+#define VERIFY_LOOKAHEAD 16 // Events parsed ahead of the one checked, a power of two
+
+struct Event {
+    unsigned long long time; // ns
+    int car;
+    char type;
+    int id;
+    int action;
+};
+
+class Verifier {
+    // Everything an event of the car needs, so checking it touches one entry. The path
+    // fields are copied from the scenario, the segment's directions at its TRAVEL line.
+    struct CarState {
+        unsigned long long last; // Time of the previous event
+        unsigned long long ticket; // Place in the ferry queue of its side
+        size_t firstSegment;
+        unsigned int segment; // Path segments completed
+        unsigned int pathLength;
+        int travelTime;
+        int id; // Connector of the current segment, from its TRAVEL line
+        char type;
+        signed char expected; // Next action
+        signed char from; // Directions of the current segment, -1 without a scenario
+        signed char to;
+    };
+
+    struct CrossingState {
+        int passing;
+        int direction; // Of the cars passing, -1 if unknown
+        unsigned long long lastStart;
+    };
+
+    // A ferry side. Cars get tickets in arrival order and loads are runs of tickets. The load
+    // that left last is [begin, end), end grows while more of its cars show up. Its cars may
+    // start after cars of the next load, they only need the ferry lock back to do so.
+    struct FerrySide {
+        std::deque<unsigned long long> arrivals; // Arrival times from ticket first on
+        unsigned long long first;
+        unsigned long long begin;
+        unsigned long long end; // begin == end while no load has left
+        unsigned long long departure; // First START_PASSING of the load
+        unsigned long long late; // Cars of the last load that arrived after it left, within tolerance
+        unsigned long long lent; // Late cars of the load before, the last load may have had them
+    };
+
+    const Scenario *scenario;
+    unsigned long long toleranceNs;
+    unsigned long long maxErrors;
+    std::vector<CarState> cars;
+    std::vector<CrossingState> crossings[2]; // Narrow bridges and crossroads
+    std::vector<FerrySide> ferries; // Two per ferry
+    unsigned long long position; // Of the current event
+    const char *unit; // "line" or "record"
+    Event pending[VERIFY_LOOKAHEAD];
+    unsigned long long pendingAt[VERIFY_LOOKAHEAD];
+    unsigned long long pushed, checked;
+
+public:
+    unsigned long long events;
+    unsigned long long violations;
+    unsigned long long unknownDirections; // Bridge and crossroad starts whose direction is not known
+    unsigned long long unknownSides; // Ferry arrivals and starts whose side is not known
+
+    Verifier(const Scenario *s, unsigned long long tolerance, unsigned long long max)
+        : scenario(s), toleranceNs(tolerance), maxErrors(max), position(0), unit("line"), pushed(0), checked(0), events(0), violations(0),
+          unknownDirections(0), unknownSides(0) {
+        if (scenario != nullptr) {
+            cars.resize(scenario->cars.size());
+            for (size_t c = 0; c < cars.size(); ++c) {
+                const CarSpec &spec = scenario->cars[c];
+                cars[c].firstSegment = spec.firstSegment;
+                cars[c].pathLength = spec.pathLength;
+                cars[c].travelTime = spec.travelTime;
+            }
+            crossings[0].resize(scenario->narrowBridges.size(), { 0, -1, 0 });
+            crossings[1].resize(scenario->crossroads.size(), { 0, -1, 0 });
+            ferries.resize(2 * scenario->ferries.size());
+        }
+    }
+
+    void SetUnit(const char *name) { unit = name; }
+    void At(unsigned long long at) { position = at; }
+
+    // Checks the event once VERIFY_LOOKAHEAD more have been pushed. The state of its car is
+    // prefetched now, so with cars all over memory the misses overlap instead of stalling
+    // every event in turn.
+    void Push(const Event &e, unsigned long long at) {
+        if (pushed - checked == VERIFY_LOOKAHEAD) CheckPending();
+        if ((size_t)e.car < cars.size()) __builtin_prefetch(&cars[e.car], 1);
+        pending[pushed % VERIFY_LOOKAHEAD] = e;
+        pendingAt[pushed % VERIFY_LOOKAHEAD] = at;
+        pushed++;
+    }
+
+    // Checks what was pushed, before anything is reported out of order
+    void Drain() {
+        while (checked < pushed) CheckPending();
+    }
+
+    void Report(int car, const char *format, ...) __attribute__((format(printf, 3, 4))) {
+        if (++violations > maxErrors) return;
+        if (position > 0) printf("%s %llu: ", unit, position);
+        if (car >= 0) printf("car %d: ", car);
+        va_list args;
+        va_start(args, format);
+        vprintf(format, args);
+        va_end(args);
+        putchar('\n');
+    }
+
+    void Check(const Event &e) {
+        events++;
+        if (e.car < 0 || e.id < 0 || e.action < TRAVEL || e.action > FINISH_PASSING ||
+            (e.type != 'N' && e.type != 'F' && e.type != 'C')) {
+            Report(-1, "malformed event");
+            return;
+        }
+        if (!Known(e)) return;
+
+        CarState &car = cars[e.car];
+        if (e.time < car.last) {
+            Report(e.car, "time went back from %.3f to %.3f ms", car.last / 1e6, e.time / 1e6);
+        }
+        if (e.action != car.expected) {
+            Report(e.car, "%s where %s was due", actionNames[e.action], actionNames[car.expected]);
+            Resync(car, e);
+            return;
+        }
+        if (e.action == TRAVEL) {
+            car.from = car.to = -1;
+            if (scenario != nullptr) {
+                if (car.segment >= car.pathLength) {
+                    Report(e.car, "travels to %c%d after the end of its path", e.type, e.id);
+                } else {
+                    const PathSegment &segment = Segment(car);
+                    if (segment.type != e.type || segment.id != e.id) {
+                        Report(e.car, "travels to %c%d, segment %u of its path is %c%d", e.type, e.id, car.segment,
+                               segment.type, segment.id);
+                    } else {
+                        car.from = segment.from;
+                        car.to = segment.to;
+                    }
+                }
+            }
+            car.type = e.type;
+            car.id = e.id;
+        } else if (e.type != car.type || e.id != car.id) {
+            Report(e.car, "%s on %c%d while traveling to %c%d", actionNames[e.action], e.type, e.id, car.type, car.id);
+        } else if (e.action == ARRIVE) {
+            if (scenario != nullptr) MinimumTime(e, car.last, car.travelTime, "travel");
+            if (e.type == 'F') Board(e, car);
+        } else if (e.action == START_PASSING) {
+            if (e.type == 'F') Depart(e, car);
+            else Enter(e, car);
+        } else {
+            if (scenario != nullptr) MinimumTime(e, car.last, Spec(e).travelTime, "pass");
+            if (e.type != 'F') {
+                CrossingState &crossing = Crossing(e);
+                if (crossing.passing > 0) crossing.passing--;
+            }
+            car.segment++;
+        }
+        car.last = e.time;
+        car.expected = (e.action + 1) % 4;
+    }
+
+    // Checks what can only be seen at the end of the trace
+    void Finish() {
+        Drain();
+        position = 0;
+        for (size_t f = 0; f < ferries.size(); ++f) CloseLoad(f / 2, ferries[f]);
+        for (size_t c = 0; c < cars.size(); ++c) {
+            const CarState &car = cars[c];
+            unsigned int length = scenario != nullptr ? car.pathLength : car.segment;
+            if (car.expected != TRAVEL) {
+                Report(c, "stopped in segment %u, %s on %c%d was due", car.segment, actionNames[car.expected],
+                       car.type, car.id);
+            } else if (car.segment < length) {
+                Report(c, "stopped after %u of %u segments, before traveling to %c%d", car.segment, length,
+                       Segment(car).type, Segment(car).id);
+            }
+        }
+    }
+
+private:
+    void CheckPending() {
+        size_t slot = checked++ % VERIFY_LOOKAHEAD;
+        position = pendingAt[slot];
+        Check(pending[slot]);
+    }
+
+    static constexpr const char *actionNames[] = { "TRAVEL", "ARRIVE", "START_PASSING", "FINISH_PASSING" };
+
+    // Grows the tables for ids seen for the first time, with a scenario they are fixed
+    bool Known(const Event &e) {
+        if (scenario != nullptr) {
+            size_t connectors = e.type == 'N' ? scenario->narrowBridges.size()
+                              : e.type == 'F' ? scenario->ferries.size() : scenario->crossroads.size();
+            if ((size_t)e.car >= cars.size() || (size_t)e.id >= connectors) {
+                Report(e.car, "%c%d or the car is not in the scenario", e.type, e.id);
+                return false;
+            }
+            return true;
+        }
+        if (e.car >= VERIFY_MAX_ID || e.id >= VERIFY_MAX_ID) {
+            Report(-1, "id out of range");
+            return false;
+        }
+        if ((size_t)e.car >= cars.size()) cars.resize(e.car + 1);
+        if (e.type != 'F') {
+            std::vector<CrossingState> &table = crossings[e.type == 'C'];
+            if ((size_t)e.id >= table.size()) table.resize(e.id + 1, { 0, -1, 0 });
+        }
+        return true;
+    }
+
+    // After a missing or extra event, continue as if the car's sequence were intact
+    void Resync(CarState &car, const Event &e) {
+        car.type = e.type;
+        car.id = e.id;
+        car.last = e.time;
+        car.expected = (e.action + 1) % 4;
+        car.from = car.to = -1;
+        if (scenario != nullptr && car.segment < car.pathLength) {
+            const PathSegment &segment = Segment(car);
+            if (segment.type == e.type && segment.id == e.id) {
+                car.from = segment.from;
+                car.to = segment.to;
+            }
+        }
+        if (e.action == FINISH_PASSING) car.segment++;
+    }
+
+    const PathSegment &Segment(const CarState &car) const {
+        return scenario->segments[car.firstSegment + car.segment];
+    }
+
+    const ConnectorSpec &Spec(const Event &e) const {
+        return e.type == 'N' ? scenario->narrowBridges[e.id]
+             : e.type == 'F' ? scenario->ferries[e.id] : scenario->crossroads[e.id];
+    }
+
+    CrossingState &Crossing(const Event &e) { return crossings[e.type == 'C'][e.id]; }
+
+    void MinimumTime(const Event &e, unsigned long long since, int ms, const char *what) {
+        unsigned long long took = e.time - since;
+        if (e.time >= since && took + toleranceNs < ms * 1000000ULL) {
+            Report(e.car, "%s on %c%d took %.3f ms, less than %d", what, e.type, e.id, took / 1e6, ms);
+        }
+    }
+
+    // A car starts on a narrow bridge or crossroad
+    void Enter(const Event &e, const CarState &car) {
+        CrossingState &crossing = Crossing(e);
+        int direction = e.type == 'N' ? car.to : car.from;
+        if (direction < 0) unknownDirections++;
+        if (crossing.passing > 0) {
+            if (direction >= 0 && crossing.direction >= 0 && direction != crossing.direction) {
+                Report(e.car, "entered %c%d in direction %d while cars of direction %d are on it", e.type, e.id,
+                       direction, crossing.direction);
+            }
+            unsigned long long gap = e.time - crossing.lastStart;
+            if (e.time >= crossing.lastStart && gap + toleranceNs < PASS_DELAY * 1000000ULL) {
+                Report(e.car, "entered %c%d %.3f ms after the car ahead, less than PASS_DELAY", e.type, e.id, gap / 1e6);
+            }
+        }
+        crossing.passing++;
+        crossing.direction = direction;
+        crossing.lastStart = e.time;
+    }
+
+    // Ferry rules need the side, so they are only checked with a scenario
+    void Board(const Event &e, CarState &car) {
+        if (scenario == nullptr || car.from < 0) {
+            unknownSides++;
+            return;
+        }
+        FerrySide &side = ferries[2 * e.id + car.from];
+        car.ticket = side.first + side.arrivals.size();
+        side.arrivals.push_back(e.time);
+    }
+
+    void Depart(const Event &e, CarState &car) {
+        if (scenario == nullptr || car.from < 0) {
+            unknownSides++;
+            return;
+        }
+        FerrySide &side = ferries[2 * e.id + car.from];
+        unsigned long long capacity = Spec(e).capacity, ticket = car.ticket;
+        if (ticket < side.begin) return; // A late car of an earlier load
+        // Part of the last load if there is room and it arrived before the load left, or
+        // starts so close to it that it cannot have waited for a load of its own
+        if (side.end > side.begin && ticket < side.begin + capacity &&
+            (ticket < side.end || Arrival(side, ticket) < side.departure || e.time <= side.departure + toleranceNs)) {
+            if (ticket >= side.end) side.end = ticket + 1;
+            if (Arrival(side, ticket) >= side.departure) side.late++;
+            return;
+        }
+        // Arrived before the full load left and left with it
+        if (side.end > side.begin && Arrival(side, ticket) < side.departure && e.time <= side.departure + toleranceNs) {
+            Report(e.car, "left on F%d in a load of more than %llu cars", e.id, capacity);
+            return;
+        }
+        CloseLoad(e.id, side);
+        side.lent = e.time <= side.departure + toleranceNs ? side.late : 0;
+        side.late = 0;
+        if (ticket >= side.begin + capacity) {
+            Report(e.car, "left on F%d with %llu cars ahead of it in its load, the capacity is %llu", e.id,
+                   ticket - side.begin, capacity);
+        }
+        side.end = ticket + 1;
+        side.departure = e.time;
+    }
+
+    unsigned long long Arrival(const FerrySide &side, unsigned long long ticket) const {
+        return side.arrivals[ticket - side.first];
+    }
+
+    // The last load is complete, it has to have been full or to have waited maxWaitTime for
+    // its first car. The next load starts after it.
+    void CloseLoad(int id, FerrySide &side) {
+        if (side.end > side.begin) {
+            const ConnectorSpec &spec = scenario->ferries[id];
+            unsigned long long size = side.end - side.begin, firstArrived = Arrival(side, side.begin);
+            if (size + side.lent < (unsigned long long)spec.capacity &&
+                side.departure + toleranceNs < firstArrived + spec.maxWaitTime * 1000000ULL) {
+                Report(-1, "F%d left with %llu of %d cars %.3f ms after the first arrived, less than maxWaitTime", id,
+                       size, spec.capacity, (side.departure - firstArrived) / 1e6);
+            }
+        }
+        side.begin = side.end;
+        while (side.first < side.begin) {
+            side.arrivals.pop_front();
+            side.first++;
+        }
+    }
+};
+
+// Parses an unsigned number at p, false if there is none. Lines are followed by a byte that
+// is no digit, so the end of the line needs no check.
+static inline bool Number(const char *&p, unsigned long long &value) {
+    if ((unsigned)(*p - '0') > 9) return false;
+    unsigned long long v = 0;
+    while ((unsigned)(*p - '0') <= 9) v = v * 10 + (*p++ - '0');
+    value = v;
+    return true;
+}
+
+template <size_t N>
+static inline bool Skip(const char *&p, const char *end, const char (&text)[N]) {
+    if ((size_t)(end - p) < N - 1 || memcmp(p, text, N - 1) != 0) return false;
+    p += N - 1;
+    return true;
+}
+
+// "tid car N3 time action" or "ThreadID: tid, CarID: car, Object: N3, time stamp: time, AID: action text"
+static bool ParseLine(const char *p, const char *end, unsigned long long unitNs, Event &e) {
+    unsigned long long car, id, time, action;
+    if (*p == 'T' && Skip(p, end, "ThreadID: ")) {
+        p = (const char*)memchr(p, ',', end - p);
+        if (p == nullptr || !Skip(p, end, ", CarID: ") || !Number(p, car) || !Skip(p, end, ", Object: ") || p == end) {
+            return false;
+        }
+        e.type = *p++;
+        if (!Number(p, id) || !Skip(p, end, ", time stamp: ") || !Number(p, time) || !Skip(p, end, ", AID: ") ||
+            !Number(p, action)) {
+            return false;
+        }
+    } else {
+        p = (const char*)memchr(p, ' ', end - p);
+        if (p == nullptr || !Number(++p, car) || *p++ != ' ' || p >= end) return false;
+        e.type = *p++;
+        if (!Number(p, id) || *p++ != ' ' || !Number(p, time) || *p++ != ' ' || !Number(p, action)) return false;
+    }
+    if (car > VERIFY_MAX_ID || id > VERIFY_MAX_ID || action > FINISH_PASSING) return false;
+    e.car = car;
+    e.id = id;
+    e.time = time * unitNs;
+    e.action = action;
+    return true;
+}
+
+// Calls line(begin, end) for every complete line in [p, end), returns where the rest starts
+template <typename Line>
+static const char *SplitLines(const char *p, const char *end, Line line) {
+    const char *start = p;
+#ifdef __SSE2__
+    const __m128i newline = _mm_set1_epi8('\n');
+    for (; end - p >= 64; p += 64) {
+        unsigned long long mask = 0;
+        for (int i = 0; i < 4; ++i) {
+            __m128i bytes = _mm_loadu_si128((const __m128i*)(p + 16 * i));
+            mask |= (unsigned long long)(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, newline)) << (16 * i);
+        }
+        while (mask != 0) {
+            const char *at = p + __builtin_ctzll(mask);
+            line(start, at);
+            start = at + 1;
+            mask &= mask - 1;
+        }
+    }
+#endif
+    for (const char *at; (at = (const char*)memchr(p, '\n', end - p)) != nullptr; p = at + 1) {
+        line(start, at);
+        start = at + 1;
+    }
+    return start;
+}
+
+static size_t ReadFull(int fd, char *buffer, size_t size) {
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = read(fd, buffer + done, size - done);
+        if (n <= 0) break;
+        done += n;
+    }
+    return done;
+}
+
+static bool VerifyText(int fd, char *buffer, size_t used, unsigned long long unitNs, Verifier &verifier,
+                       unsigned long long &bytes) {
+    unsigned long long lineNumber = 0;
+    auto line = [&](const char *begin, const char *end) {
+        Event e;
+        lineNumber++;
+        if (end > begin && end[-1] == '\r') end--;
+        if (begin == end) return;
+        if (ParseLine(begin, end, unitNs, e)) {
+            verifier.Push(e, lineNumber);
+        } else {
+            verifier.Drain();
+            verifier.At(lineNumber);
+            verifier.Report(-1, "cannot parse \"%.*s\"", (int)std::min<long>(end - begin, 80), begin);
+        }
+    };
+    while (true) {
+        bytes += used;
+        const char *rest = SplitLines(buffer, buffer + used, line);
+        size_t kept = buffer + used - rest;
+        memmove(buffer, rest, kept);
+        if (kept == VERIFY_BUFFER_SIZE) {
+            fprintf(stderr, "A line is longer than %d bytes.\n", VERIFY_BUFFER_SIZE);
+            return false;
+        }
+        size_t n = ReadFull(fd, buffer + kept, VERIFY_BUFFER_SIZE - kept);
+        if (n == 0) {
+            buffer[kept] = '\n'; // The last line has no newline, ParseLine needs one after it
+            if (kept > 0) line(buffer, buffer + kept);
+            return true;
+        }
+        bytes -= kept; // Counted with the previous read already
+        used = kept + n;
+    }
+}
+
+static bool VerifyBinary(int fd, char *buffer, size_t used, Verifier &verifier, unsigned long long &bytes) {
+    TraceHeader header;
+    if (used < TRACE_HEADER_SIZE) used += ReadFull(fd, buffer + used, TRACE_HEADER_SIZE - used);
+    memcpy(&header, buffer, sizeof(header));
+    if (used < TRACE_HEADER_SIZE || header.version != TRACE_VERSION || header.recordSize != sizeof(TraceRecord)) {
+        fprintf(stderr, "Unsupported binary trace.\n");
+        return false;
+    }
+    verifier.SetUnit("record");
+    // A trace that was not closed has no count, then every whole record is read
+    unsigned long long limit = header.recordCount > 0 ? header.recordCount : ~0ULL, record = 0;
+    used -= TRACE_HEADER_SIZE;
+    memmove(buffer, buffer + TRACE_HEADER_SIZE, used);
+    bytes += TRACE_HEADER_SIZE;
+    while (true) {
+        size_t whole = used / sizeof(TraceRecord);
+        const TraceRecord *records = (const TraceRecord*)buffer;
+        for (size_t i = 0; i < whole && record < limit; ++i) {
+            const TraceRecord &r = records[i];
+            Event e = { r.time, r.carID, r.connectorType, r.connectorID, r.action };
+            verifier.Push(e, ++record);
+        }
+        bytes += whole * sizeof(TraceRecord);
+        size_t kept = used - whole * sizeof(TraceRecord);
+        memmove(buffer, buffer + whole * sizeof(TraceRecord), kept);
+        size_t n = record < limit ? ReadFull(fd, buffer + kept, VERIFY_BUFFER_SIZE - kept) : 0;
+        if (n == 0) break;
+        used = kept + n;
+    }
+    if (header.recordCount > 0 && record < header.recordCount) {
+        fprintf(stderr, "The trace ends after %llu of %llu records.\n", record, header.recordCount);
+        return false;
+    }
+    return true;
+}
+
+// Nanoseconds per printed time stamp unit, 0 for an unknown unit
+static unsigned long long TimestampUnit(const char *name) {
+    if (strcmp(name, "ms") == 0) return 1000000;
+    if (strcmp(name, "us") == 0) return 1000;
+    if (strcmp(name, "ns") == 0) return 1;
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    const char *scenarioPath = nullptr, *tracePath = nullptr;
+    unsigned long long unitNs = 1000000, maxErrors = 100;
+    double toleranceMs = 1;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--scenario") == 0 && i + 1 < argc) {
+            scenarioPath = argv[++i];
+        } else if (strcmp(argv[i], "--precision") == 0 && i + 1 < argc && TimestampUnit(argv[i + 1]) != 0) {
+            unitNs = TimestampUnit(argv[++i]);
+        } else if (strcmp(argv[i], "--tolerance") == 0 && i + 1 < argc) {
+            toleranceMs = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--max-errors") == 0 && i + 1 < argc) {
+            maxErrors = strtoull(argv[++i], nullptr, 10);
+        } else if (argv[i][0] != '-' && tracePath == nullptr) {
+            tracePath = argv[i];
+        } else {
+            fprintf(stderr, "Usage: %s [--scenario FILE] [--precision ms|us|ns] [--tolerance MS] [--max-errors N]"
+                            " [trace]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    Scenario scenario;
+    if (scenarioPath != nullptr) {
+        int fd = open(scenarioPath, O_RDONLY);
+        if (fd < 0 || !LoadScenario(fd, scenario)) {
+            fprintf(stderr, "%s: cannot load the scenario.\n", scenarioPath);
+            return 2;
+        }
+        close(fd);
+    }
+    int fd = tracePath != nullptr ? open(tracePath, O_RDONLY) : STDIN_FILENO;
+    if (fd < 0) {
+        perror(tracePath);
+        return 2;
+    }
+
+    Verifier verifier(scenarioPath != nullptr ? &scenario : nullptr, (unsigned long long)(toleranceMs * 1e6), maxErrors);
+    std::vector<char> buffer(VERIFY_BUFFER_SIZE);
+    unsigned long long bytes = 0;
+    auto start = std::chrono::steady_clock::now();
+    size_t used = ReadFull(fd, buffer.data(), VERIFY_BUFFER_SIZE);
+    bool ok = used >= 8 && memcmp(buffer.data(), TRACE_MAGIC, 8) == 0
+              ? VerifyBinary(fd, buffer.data(), used, verifier, bytes)
+              : VerifyText(fd, buffer.data(), used, unitNs, verifier, bytes);
+    verifier.Drain();
+    if (ok) verifier.Finish();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    if (verifier.violations > maxErrors) printf("... %llu more\n", verifier.violations - maxErrors);
+    // Not checking a rule must not look like passing it
+    if (verifier.unknownDirections > 0) {
+        fprintf(stderr, "Warning: %llu bridge and crossroad starts without a known direction, opposite directions"
+                        " were not checked for them%s.\n", verifier.unknownDirections,
+                scenarioPath == nullptr ? " (no --scenario)" : "");
+    }
+    if (verifier.unknownSides > 0) {
+        fprintf(stderr, "Warning: %llu ferry events without a known side, ferry loads were not checked for them%s.\n",
+                verifier.unknownSides, scenarioPath == nullptr ? " (no --scenario)" : "");
+    }
+    fprintf(stderr, "%llu events, %llu violations, %.1f MB in %.3f s (%.0f MB/s)\n", verifier.events,
+            verifier.violations, bytes / 1e6, seconds, bytes / 1e6 / seconds);
+    return !ok ? 2 : verifier.violations > 0 ? 1 : 0;
+}
@@ -0,0 +1,165 @@
+#include <queue>
+#include <vector>
+#include "virtual_engine.h"
+#include "WriteOutput.h"
+#include "helper.h"
+#include "connector_rules.h"
+
+namespace {
+
+typedef unsigned long long VirtualTime;
+
+enum EventKind {
+    CAR_ARRIVE,     // the car reached the connector of its current segment
+    CAR_FINISH,     // the car left the connector
+    CONNECTOR_WAKE  // a pass delay or a timeout of the connector is over
+};
+
+struct Event {
+    VirtualTime time;
+    unsigned long long seq; // keeps events of the same time in scheduling order
+    EventKind kind;
+    int car;
+    char connectorType;
+    int connectorID;
+
+    bool operator>(const Event &other) const {
+        return time != other.time ? time > other.time : seq > other.seq;
+    }
+};
+
+class Simulation {
+    const Scenario &scenario;
+    std::priority_queue<Event, std::vector<Event>, std::greater<Event> > events;
+    unsigned long long nextSeq;
+    std::vector<size_t> segmentIndex; // current path segment of every car
+    VirtualSummary *summary; // Filled instead of writing the trace, if set
+    std::vector<VirtualTime> arrivedAt; // Only kept for the summary
+    std::vector<CrossingRules<Simulation> > bridges;
+    std::vector<FerryRules<Simulation> > ferries;
+    std::vector<CrossingRules<Simulation> > crossroads;
+
+public:
+    typedef VirtualTime Time;
+    typedef int Car;
+
+    VirtualTime now;
+
+    Simulation(const Scenario &s, VirtualSummary *summary)
+        : scenario(s), nextSeq(0), segmentIndex(s.cars.size(), 0), summary(summary), now(0) {
+        if (summary != nullptr) {
+            *summary = VirtualSummary();
+            arrivedAt.resize(s.cars.size());
+        }
+        for (size_t i = 0; i < s.narrowBridges.size(); ++i)
+            bridges.emplace_back(ConnectorKey{ 'N', (int)i, (int)i }, s.narrowBridges[i], 2);
+        for (size_t i = 0; i < s.ferries.size(); ++i)
+            ferries.emplace_back(ConnectorKey{ 'F', (int)i, (int)i }, s.ferries[i]);
+        for (size_t i = 0; i < s.crossroads.size(); ++i)
+            crossroads.emplace_back(ConnectorKey{ 'C', (int)i, (int)i }, s.crossroads[i], 4);
+    }
+
+    void Schedule(VirtualTime time, EventKind kind, int car, char connectorType = 0, int connectorID = 0) {
+        Event event = { time, nextSeq++, kind, car, connectorType, connectorID };
+        events.push(event);
+    }
+
+    void Output(int carID, char connectorType, int connectorID, Action action) {
+        if (summary == nullptr) {
+            WriteOutputAt(carID, now * 1000000ULL, carID, connectorType, connectorID, action);
+            return;
+        }
+        summary->events++;
+        if (action == ARRIVE) {
+            arrivedAt[carID] = now;
+        } else if (action == START_PASSING) {
+            int type = connectorType == 'N' ? 0 : connectorType == 'F' ? 1 : 2;
+            summary->waits[type].push_back(now - arrivedAt[carID]);
+        }
+    }
+
+    void CountSwitch() {
+        if (summary != nullptr) summary->directionSwitches++;
+    }
+
+    void CountDeparture(int cars, int capacity) {
+        if (summary == nullptr) return;
+        summary->ferryDepartures++;
+        summary->ferryCars += cars;
+        summary->ferrySeats += capacity;
+    }
+
+    // The car leaves for the connector of its current segment, or is done if there is none
+    void Travel(int carID) {
+        const CarSpec &car = scenario.cars[carID];
+        std::span<const PathSegment> path = scenario.Path(car);
+        if (segmentIndex[carID] == path.size()) {
+            if (summary != nullptr && !path.empty()) {
+                summary->latencies.push_back(now);
+                if (now > summary->makespan) summary->makespan = now;
+            }
+            return;
+        }
+        const PathSegment &segment = path[segmentIndex[carID]];
+        Output(carID, segment.type, segment.id, TRAVEL);
+        Schedule(now + car.travelTime, CAR_ARRIVE, carID);
+    }
+
+    // The host interface of the connector rules, virtual time is in milliseconds
+    static VirtualTime Millis(int milliseconds) { return milliseconds; }
+
+    VirtualTime Now() const { return now; }
+
+    void WakeAt(const ConnectorKey &key, VirtualTime time) {
+        Schedule(time, CONNECTOR_WAKE, -1, key.type, key.id);
+    }
+
+    void StartPassing(int carID, const ConnectorKey &key, int travelTime) {
+        Output(carID, key.type, key.id, START_PASSING);
+        Schedule(now + travelTime, CAR_FINISH, carID, key.type, key.id);
+    }
+
+    void Run() {
+        for (size_t i = 0; i < scenario.cars.size(); ++i) Travel(i);
+
+        while (!events.empty()) {
+            Event event = events.top();
+            events.pop();
+            now = event.time;
+
+            if (event.kind == CAR_ARRIVE) {
+                const PathSegment &segment = scenario.Path(scenario.cars[event.car])[segmentIndex[event.car]];
+                Output(event.car, segment.type, segment.id, ARRIVE);
+                switch (segment.type) {
+                    case 'N': bridges[segment.id].Arrive(*this, event.car, segment.to); break;
+                    case 'F': ferries[segment.id].Arrive(*this, event.car, segment.from); break;
+                    case 'C': crossroads[segment.id].Arrive(*this, event.car, segment.from); break;
+                }
+            } else if (event.kind == CAR_FINISH) {
+                Output(event.car, event.connectorType, event.connectorID, FINISH_PASSING);
+                if (event.connectorType == 'N') bridges[event.connectorID].Finish(*this);
+                else if (event.connectorType == 'C') crossroads[event.connectorID].Finish(*this);
+                segmentIndex[event.car]++;
+                Travel(event.car);
+            } else {
+                switch (event.connectorType) {
+                    case 'N': bridges[event.connectorID].Wake(*this); break;
+                    case 'F': ferries[event.connectorID].Wake(*this); break;
+                    case 'C': crossroads[event.connectorID].Wake(*this); break;
+                }
+            }
+        }
+    }
+};
+
+} // namespace
+
+void RunVirtual(const Scenario &scenario) {
+    Simulation sim(scenario, nullptr);
+    sim.Run();
+}
+
+void SummarizeVirtual(const Scenario &scenario, VirtualSummary &summary) {
+    Simulation sim(scenario, &summary);
+    sim.Run();
+}
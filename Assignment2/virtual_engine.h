@@ -0,0 +1,29 @@
+#ifndef HOMEWORK2_VIRTUAL_ENGINE_H
+#define HOMEWORK2_VIRTUAL_ENGINE_H
+
+#include <vector>
+#include "scenario.h"
+
+// Runs the scenario as a discrete event simulation on a virtual clock. Nothing sleeps and
+// no thread is created per car, the trace has the same format as the threaded run with the
+// car id in place of the thread id. Results only depend on the input.
+void RunVirtual(const Scenario &scenario);
+
+//! What a virtual run reports instead of a trace, for comparing configurations. Times are in
+//! virtual milliseconds, every car starts at 0.
+struct VirtualSummary {
+    unsigned long long events; // Trace lines the run would have written
+    unsigned long long makespan; // When the last car finished
+    std::vector<unsigned long long> latencies; // Of every car with a path, until its last FINISH_PASSING
+    std::vector<unsigned long long> waits[3]; // ARRIVE to START_PASSING of every pass, on N, F and C
+    unsigned long long directionSwitches; // On bridges and crossroads
+    unsigned long long ferryDepartures;
+    unsigned long long ferrySeats; // Capacity of the ferries that departed
+    unsigned long long ferryCars;
+};
+
+// Runs the scenario like RunVirtual but fills summary instead of writing a trace. It uses no
+// global state, so runs on different threads do not affect each other.
+void SummarizeVirtual(const Scenario &scenario, VirtualSummary &summary);
+
+#endif //HOMEWORK2_VIRTUAL_ENGINE_H